@@ -1,291 +1,4213 @@
-/* 
- * Gère le déplacement d'un moteur pas à pas (stepper) au moyen de
- * deux boutons connectés aux entrées INT0 et INT1.
- * Un circuit intégré spécifique aide le micro-contrôleur à générer
- * la commutation.
- * @author jean-michel-gonet
- */
-
-#include <xc.h>
-
-/**
- * Configure le ECCP3 et le port A pour produire la commutation
- * de stationnement sur le pas en cours.
- * @param pas Position en cours dans la séquence de stationnement.
- */
-void commutationStationnement(unsigned char pas) {
-    // Séquence de commutation pour le stationnement.
-    static unsigned char commutateursStationnement[] = {
-        1, 4, 2, 8
-    };
-
-    unsigned char n;
-
-    // En arrêt, le PWM est à 50%:
-    CCPR3L = 16;
-
-    // Les 2 bits plus signifiants du numéro de séquence contiennent
-    // la position des commutateurs pour les ponts:
-    n = pas >> 3;
-    PORTA = commutateursStationnement[n];
-}
-
-/**
- * Configure le ECCP3 et le port A pour produire le micro-pas correspondant
- * sur la séquence de commutation.
- * @param pas Position en cours dans la séquence de commutation.
- */
-void commutationDeplacement(char pas) {
-    // Valeurs pré-calculées pour les micro-pas.
-    static unsigned char cos[] = {
-        32, 31, 27, 22, 16, 10,  5,  1,
-         0,  1,  5, 10, 16, 22, 27, 31
-    };
-
-    // Séquence de commutation pour le déplacement.
-    static unsigned char commutateursDeplacement[] = {
-        5, 6, 10, 9
-    };
-
-    char n;
-
-    // Les 4 bits moins signifiants du numéro de séquence contiennent
-    // l'index du tableau de micro-pas:
-    n = pas & 0x0F;
-    CCPR3L = cos[n];
-
-    // Les 2 bits plus signifiants du numéro de séquence contiennent
-    // la position des commutateurs pour les ponts:
-    n = pas >> 3;
-    PORTA = commutateursDeplacement[n];
-}
-
-/**
- * Liste d'états pour la machine à états.
- */
-enum Etat {
-    /** Le moteur est à l'arrêt, sur un pas entier.*/
-    ARRET,
-    /** Le moteur avance. */
-    MARCHE_AVANT,
-    /** Le moteur va s'arrêter dès qu'il atteint un pas complet.*/
-    FREIN_AVANT,
-    /** Le moteur recule. */
-    MARCHE_ARRIERE,
-    /** Le moteur va s'arrêter dès qu'il atteint un pas complet.*/
-    FREIN_ARRIERE
-};
-
-/**
- * Liste d'événements pour la machine à états.
- */
-enum Evenement {
-    /** Le moteur doit avancer.*/
-    AVANCE,
-    /** Le moteur doit reculer.*/
-    RECULE,
-    /** Le moteur doit s'arrêter.*/
-    ARRETE,
-    /** Suivante �tape dans la séquence.*/
-    TICTAC
-};
-
-/**
- * Machine à états.
- * @param evenement L'événement à gérer.
- */
-void machine(enum Evenement evenement) {
-    // État principal de la machine.
-    static enum Etat etat = ARRET;
-
-    // Position dans la séquence de commutation, entre 0 et 31.
-    static unsigned char pas = 0;
-
-    switch(etat) {
-        case ARRET:
-            switch(evenement) {
-                case AVANCE:
-                    etat = MARCHE_AVANT;
-                    break;
-                case RECULE:
-                    etat = MARCHE_ARRIERE;
-                    break;
-            }
-            break;
-
-        // Le moteur avance en suivant la séquence de commutation
-        // jusqu'à ce qu'il reçoive l'ordre de s'arrêter.
-        case MARCHE_AVANT:
-            switch(evenement) {
-                case TICTAC:
-                    commutationDeplacement(pas);
-                    pas++;
-                    if (pas > 31) {
-                        pas = 0;
-                    }
-                    break;
-                case RECULE:
-                case ARRETE:
-                    etat = FREIN_AVANT;
-                    break;
-            }
-            break;
-
-        // Le moteur continue d'avancer jusqu'à ce qu'il
-        // arrive sur un pas entier.
-        case FREIN_AVANT:
-            switch(evenement) {
-                case TICTAC:
-                    switch(pas) {
-                        case 0:
-                        case 8:
-                        case 16:
-                        case 24:
-                            commutationStationnement(pas);
-                            etat = ARRET;
-                            break;
-                        default:
-                            commutationDeplacement(pas);
-                            pas++;
-                            if (pas > 31) {
-                                pas = 0;
-                            }
-                            break;
-                    }
-                    break;
-            }
-            break;
-        case MARCHE_ARRIERE:
-            switch(evenement) {
-                case TICTAC:
-                    commutationDeplacement(pas);
-                    pas--;
-                    if (pas > 31) {
-                        pas = 31;
-                    }
-                    break;
-                case AVANCE:
-                case ARRETE:
-                    etat = FREIN_ARRIERE;
-                    break;
-            }
-            break;
-
-        // Le moteur continue de reculer jusqu'à ce qu'il
-        // arrive sur un pas entier.
-        case FREIN_ARRIERE:
-            switch(evenement) {
-                case TICTAC:
-                    switch(pas) {
-                        case 0:
-                        case 8:
-                        case 16:
-                        case 24:
-                            commutationStationnement(pas);
-                            etat = ARRET;
-                            break;
-                        default:
-                            commutationDeplacement(pas);
-                            pas--;
-                            if (pas > 31) {
-                                pas = 31;
-                            }
-                            break;
-                    }
-                    break;
-            }
-            break;
-    }
-}
-
-/**
- * Interruptions.
- */
-void interrupt interruptionsHP() {
-    
-    static char n = 0;
-
-    // Détecte de quel type d'interruption il s'agit:
-    if (PIR1bits.TMR2IF) {
-        PIR1bits.TMR2IF = 0;
-        if (n == 0) {
-            machine(TICTAC);
-        }
-        n++;
-        if (n > 25) {
-            n = 0;
-        }
-    }
-
-    // Détecte de quel type d'interruption il s'agit:
-    if (INTCON3bits.INT2IF) {
-        INTCON3bits.INT2IF=0;
-        machine(AVANCE);
-    }
-    if (INTCON3bits.INT1IF) {
-        INTCON3bits.INT1IF = 0;
-        machine(RECULE);
-    }
-}
-
-/**
- * Point d'entrée du programme.
- * Configure le port A comme sortie, le temporisateur 2, le module
- * CCP3 et les interruptions INT0 et INT1.
- */
-void main() {
-    ANSELA = 0x00;      // Désactive les convertisseurs A/D.
-    ANSELB = 0x00;      // Désactive les convertisseurs A/D.
-    ANSELC = 0x00;      // Désactive les convertisseurs A/D.
-
-    TRISA = 0x00;       // Tous les bits du port A comme sorties.
-
-
-    // Active le PWM sur CCP5:
-    T2CONbits.T2CKPS = 1;       // Pas de diviseur de fréq. en entrée.
-    T2CONbits.T2OUTPS = 8;      // Pour ménager le traitement d'int.
-    PR2 = 32;                   // Période du tmr2: 32
-    T2CONbits.TMR2ON = 1;       // Active le tmr2
-    CCPTMRS0bits.C3TSEL = 0;    // CCP3 branché sur tmr2
-    CCP3CONbits.P3M = 2;        // Mode demi-pont.
-    CCP3CONbits.CCP3M = 0xC;    // Active le CCP3.
-
-    TRISBbits.RB5 = 0;          // Active la sortie P3A.
-    TRISCbits.RC7 = 0;          // Active la sortie P3B.
-
-    PORTA = 9;
-    PORTB = 0x00;
-    PORTC = 0xFF;
-
-    // Prépare les interruptions de haute priorité temporisateur 2:
-    PIE1bits.TMR2IE = 1;        // Active les interruptions.
-    IPR1bits.TMR2IP = 1;        // En haute priorité.
-    PIR1bits.TMR2IF = 0;        // Baisse le drapeau.
-
-    // Prépare les interruptions de basse priorité INT1 et INT2:
-    TRISBbits.RB2 = 1;          // INT2 comme entrée digitale.
-    TRISBbits.RB1 = 1;          // INT1 comme entrée digitale.
-
-    INTCON2bits.RBPU=0;         // Active les résistances de tirage...
-    WPUBbits.WPUB2 = 1;         // ... sur INT2 ...
-    WPUBbits.WPUB1 = 1;         // ... et INT1.
-
-    INTCON2bits.INTEDG2 = 0;    // Int. de INT2 sur flanc descendant.
-    INTCON2bits.INTEDG1 = 0;    // Int. de INT1 sur flanc descendant.
-
-    INTCON3bits.INT2IE = 1;     // Interruptions pour INT2...
-    INTCON3bits.INT2IP = 1;     // ... en basse priorité.
-    INTCON3bits.INT1IE = 1;     // Interruptions pour INT1...
-    INTCON3bits.INT1IP = 1;     // ... en basse priorité.
-
-    // Active les interruptions de haute priorité:
-    RCONbits.IPEN = 1;
-    INTCONbits.GIEH = 1;
-    INTCONbits.GIEL = 0;
-
-    // Place le moteur en position arrêtée sur le pas 0:
-    commutationStationnement(0);
-
-    // Dodo:
-    while(1);
-}
+/* 
+ * Gère le déplacement d'un moteur pas à pas (stepper) au moyen de
+ * deux boutons connectés aux entrées INT0 et INT1, ou de commandes
+ * reçues par trames sur la liaison série.
+ * Un circuit intégré spécifique aide le micro-contrôleur à générer
+ * la commutation.
+ * @author jean-michel-gonet
+ */
+
+#include <xc.h>
+#include <stdint.h>
+
+/**
+ * Fréquence de l'oscillateur: HFINTOSC à 1MHz, qui est la
+ * configuration par défaut du PIC18F25K22.
+ */
+#define _XTAL_FREQ 1000000
+
+/**
+ * Régulation matérielle du courant.
+ * Si HACHAGE_MATERIEL est défini, le DAC établit à chaque micro-pas la
+ * consigne de courant, et le comparateur C2 la compare à la tension du
+ * shunt, connecté sur C12IN2- (RB3). Dès que le courant dépasse la
+ * consigne, le comparateur déclenche l'arrêt automatique de l'ECCP3,
+ * qui redémarre tout seul au début de la période PWM suivante.
+ * Le hachage du courant ne coûte alors rien au micro-contrôleur.
+ */
+// #define HACHAGE_MATERIEL
+
+/**
+ * Capteur d'index.
+ * Si CAPTEUR_INDEX est défini, un capteur connecté sur RB4 donne une
+ * impulsion (active à 1) par tour du moteur. La position au milieu de
+ * chaque impulsion est comparée à celle de la première: l'écart compte
+ * les pas perdus, sans codeur (voir indexTache).
+ */
+// #define CAPTEUR_INDEX
+
+/**
+ * Tables de couple linéaire.
+ * Si COUPLE_LINEAIRE est défini, les tables de commutation d'origine,
+ * en cosinus, sont remplacées par des tables qui placent le rotor d'un
+ * moteur hybride à intervalles d'angle égaux: les micro-pas d'origine
+ * vont de 1° à 26° électriques, ce qui module la vitesse et excite les
+ * résonances. Elles sont calculées sur l'hôte par hote/tables.c, pour
+ * un couple de détente de 8% du couple de maintien.
+ */
+// #define COUPLE_LINEAIRE
+
+/**
+ * Calibration du courant.
+ * Le temps mort des ponts et la tolérance des composants font que le
+ * rapport cyclique 16 n'alimente pas les deux bobines du même courant.
+ * Si CALIBRATION_COURANT est défini, le contrôleur mesure au démarrage,
+ * avec le convertisseur A/D, le courant de maintien de chaque bobine
+ * dans le shunt connecté sur AN9 (RB3, le même que pour
+ * HACHAGE_MATERIEL). La correction qui équilibre les courants est
+ * ajoutée aux rapports cycliques de toutes les tables, et conservée en
+ * EEPROM pour les démarrages où le moteur n'est pas alimenté (voir
+ * calibrationInitialise).
+ */
+// #define CALIBRATION_COURANT
+
+/**
+ * Apprentissage d'un trajet.
+ * Si APPRENTISSAGE est défini, deux boutons connectés sur RC0 et RC1
+ * permettent de préparer un travail sans PC: l'opérateur amène le
+ * moteur avec INT1 et INT2 sur chaque point de passage et le mémorise
+ * avec RC0; RC1 rejoue ensuite le trajet en déplacements profilés, à
+ * la vitesse maximum. Le trajet est conservé en EEPROM (voir
+ * apprentissageTache).
+ */
+// #define APPRENTISSAGE
+
+/**
+ * Sortie «en position».
+ * Si SORTIE_EN_POSITION est défini, c'est le bit du port de sortie que
+ * l'interruption qui termine un freinage, ou une lecture, met à 1, et
+ * que le départ suivant ou une surintensité remet à 0;
+ * DIRECTION_EN_POSITION est le bit de direction de la même broche. Un
+ * automate peut enchaîner sur la fin du mouvement sans interroger la
+ * liaison série. La sortie peut attendre que le rotor se stabilise (voir
+ * COMMANDE_EN_POSITION).
+ */
+// #define SORTIE_EN_POSITION LATCbits.LATC2
+// #define DIRECTION_EN_POSITION TRISCbits.RC2
+
+/**
+ * Chemin des pas rapide.
+ * Par défaut, le chemin des pas est compact: machine() appelle
+ * commutationDeplacement() dans les deux sens, qui compare chaque
+ * rapport cyclique au précédent pour choisir la décroissance. Si
+ * COMMUTATION_RAPIDE est défini, la commutation est développée dans
+ * machine() pour chaque sens, sans appel, et la décroissance vient de
+ * tables calculées d'avance pour chaque sens (voir tablePrepare): le
+ * pas coûte moins de cycles, et le programme plus de mémoire. make
+ * perf-variantes compare les deux (voir hote/perf.sh).
+ */
+// #define COMMUTATION_RAPIDE
+
+/**
+ * Quadrant dont les commutateurs sont présents sur le port A, ou
+ * QUADRANT_INCONNU si le port A contient autre chose.
+ * Sur le PIC18F25K22, le ECCP3 n'a que les sorties P3A et P3B: les modes
+ * pont complet et l'aiguillage des impulsions ne peuvent pas remplacer
+ * les commutateurs du port A. À défaut, le port A n'est écrit qu'aux
+ * changements de quadrant, un micro-pas sur huit.
+ */
+#define QUADRANT_INCONNU 0xFF
+static unsigned char quadrant = QUADRANT_INCONNU;
+
+/**
+ * Modes de décroissance du courant.
+ * Chaque pont est un L6202: son entrée ENABLE reçoit P3A ou P3B, et ses
+ * entrées IN1 et IN2 deux bits du port A. Pendant la partie basse du
+ * PWM, ENABLE ouvre les 4 commutateurs et le courant revient à
+ * l'alimentation par les diodes: la décroissance est toujours rapide,
+ * et le micro-contrôleur ne peut pas la changer période par période.
+ * Il peut par contre, au début de chaque micro-pas, aider le courant de
+ * la bobine qui doit baisser pendant une ou deux périodes du PWM
+ * (528µs), avant de revenir à la commutation normale. Le temporisateur
+ * 4, réglé comme le 2 mais sans post-diviseur, marque ces périodes
+ * (voir decroissanceDemarre):
+ */
+/** La bobine est court-circuitée (IN1 = IN2 = 0) pendant la partie
+ * haute du PWM: le courant tourne dans les commutateurs du bas, et
+ * baisse lentement. Une période.*/
+#define DECROISSANCE_LENTE 0
+/** Le ENABLE de la bobine reste bas: le courant revient à
+ * l'alimentation par les diodes, et s'arrête à zéro. L'autre bobine,
+ * dont le courant monte, est alimentée à 100%. Une période.*/
+#define DECROISSANCE_RAPIDE 1
+/** Décroissance rapide, puis lente. Deux périodes.*/
+#define DECROISSANCE_MIXTE 2
+/** Pas d'aide: la commutation normale, seule.*/
+#define DECROISSANCE_AUCUNE 3
+
+/**
+ * Mode de décroissance en service.
+ */
+static volatile unsigned char decroissanceMode = DECROISSANCE_AUCUNE;
+
+/**
+ * Rapport cyclique qui alimente complètement le pont de P3A.
+ */
+#define RAPPORT_PLEIN (32 + 1)
+
+/**
+ * Décroissance en cours.
+ */
+static struct {
+    /** Commutateurs du pont dont le courant baisse au micro-pas en
+     * cours (0x03 ou 0x0C), ou 0.*/
+    unsigned char pont;
+    /** Périodes du PWM avant le retour à la commutation normale.*/
+    unsigned char phases;
+    /** Rapport cyclique du micro-pas en cours.*/
+    unsigned char rapport;
+} decroissance;
+
+/**
+ * Rapport cyclique du stationnement: 16, soit environ 50%, corrigé par
+ * la calibration du courant.
+ */
+static unsigned char rapportStationnement = 16;
+
+/**
+ * Configure le ECCP3 et le port A pour produire la commutation
+ * de stationnement sur le pas en cours.
+ * @param pas Position en cours dans la séquence de stationnement.
+ */
+void commutationStationnement(unsigned char pas) {
+    // Séquence de commutation pour le stationnement.
+    static unsigned char commutateursStationnement[] = {
+        1, 4, 2, 8
+    };
+
+    unsigned char n;
+
+    // En arrêt, le PWM est à 50%:
+    CCPR3L = rapportStationnement;
+#ifdef HACHAGE_MATERIEL
+    // ... et le courant est limité à la moitié:
+    VREFCON2 = 16;
+#endif
+
+    // Les 2 bits plus signifiants du numéro de séquence contiennent
+    // la position des commutateurs pour les ponts:
+    n = pas >> 3;
+    PORTA = commutateursStationnement[n];
+    quadrant = QUADRANT_INCONNU;
+    decroissance.pont = 0;
+    decroissance.phases = 0;
+}
+
+/**
+ * Tables de commutation pour le déplacement.
+ */
+struct TableCommutation {
+    /** Rapport cyclique de chaque micro-pas.*/
+    unsigned char cos[16];
+    /** Position des commutateurs des ponts pour chaque quadrant.*/
+    unsigned char commutateurs[4];
+#ifdef HACHAGE_MATERIEL
+    /** Consigne de courant pour chaque micro-pas: c'est le courant de
+     * la bobine la plus chargée, soit max(cos, 32 - cos), limité aux
+     * 5 bits du DAC.*/
+    unsigned char consigneCourant[16];
+#endif
+#ifdef COMMUTATION_RAPIDE
+    /** Commutateurs du pont dont le courant baisse à chaque micro-pas,
+     * en marche avant puis en marche arrière (voir tablePrepare).*/
+    unsigned char pontAvant[16];
+    unsigned char pontArriere[16];
+#endif
+};
+
+/**
+ * Deux jeux de tables: celui qui est en service, et la réserve, qui
+ * peut recevoir de nouvelles tables par la liaison série.
+ */
+static struct TableCommutation tables[2] = {
+    {
+#ifdef COUPLE_LINEAIRE
+        // Valeurs pré-calculées par tables -c -d 8.
+        {
+            32, 25, 21, 18, 16, 14, 11,  7,
+             0,  7, 11, 14, 16, 18, 21, 25
+        },
+        // Séquence de commutation pour le déplacement.
+        {
+            5, 6, 10, 9
+        },
+#ifdef HACHAGE_MATERIEL
+        {
+            31, 25, 21, 18, 16, 18, 21, 25,
+            31, 25, 21, 18, 16, 18, 21, 25
+        }
+#endif
+#else
+        // Valeurs pré-calculées pour les micro-pas.
+        {
+            32, 31, 27, 22, 16, 10,  5,  1,
+             0,  1,  5, 10, 16, 22, 27, 31
+        },
+        // Séquence de commutation pour le déplacement.
+        {
+            5, 6, 10, 9
+        },
+#ifdef HACHAGE_MATERIEL
+        {
+            31, 31, 27, 22, 16, 22, 27, 31,
+            31, 31, 27, 22, 16, 22, 27, 31
+        }
+#endif
+#endif
+    }
+};
+
+/**
+ * Jeu de tables en service.
+ */
+static struct TableCommutation *table = &tables[0];
+
+/**
+ * Vaut 1 si la réserve doit être mise en service au prochain pas entier.
+ */
+static volatile unsigned char tableEchange = 0;
+
+/**
+ * Rend le jeu de tables qui n'est pas en service.
+ * @return La réserve.
+ */
+struct TableCommutation *tableReserve() {
+    if (table == &tables[0]) {
+        return &tables[1];
+    }
+    return &tables[0];
+}
+
+/**
+ * Configure le ECCP3 et le port A pour produire le micro-pas correspondant
+ * sur la séquence de commutation.
+ * @param pas Position en cours dans la séquence de commutation.
+ */
+void commutationDeplacement(char pas) {
+    char n;
+
+    // Les nouvelles tables sont mises en service sur un pas entier,
+    // où le courant de chaque bobine est au maximum ou nul:
+    if (tableEchange && (pas & 0x07) == 0) {
+        table = tableReserve();
+        tableEchange = 0;
+        quadrant = QUADRANT_INCONNU;
+    }
+
+    // Les 4 bits moins signifiants du numéro de séquence contiennent
+    // l'index du tableau de micro-pas. Le courant de la bobine de P3A
+    // suit le rapport cyclique, celui de la bobine de P3B son
+    // complément:
+    n = pas & 0x0F;
+    decroissance.pont = 0;
+    if (quadrant != QUADRANT_INCONNU) {
+        if (table->cos[n] < decroissance.rapport) {
+            decroissance.pont = 0x03;
+        } else if (table->cos[n] > decroissance.rapport) {
+            decroissance.pont = 0x0C;
+        }
+    }
+    decroissance.rapport = table->cos[n];
+    CCPR3L = decroissance.rapport;
+#ifdef HACHAGE_MATERIEL
+    VREFCON2 = table->consigneCourant[n];
+#endif
+
+    // Les 2 bits plus signifiants du numéro de séquence contiennent
+    // la position des commutateurs pour les ponts. Le changement de
+    // quadrant inverse la bobine dont le courant est nul (cos = 0 ou 32),
+    // donc il ne produit pas d'à-coup même si le nouveau rapport
+    // cyclique n'est appliqué qu'à la période PWM suivante:
+    n = pas >> 3;
+    if (n != quadrant) {
+        quadrant = n;
+        PORTA = table->commutateurs[n];
+    }
+}
+
+#ifdef COMMUTATION_RAPIDE
+/**
+ * Rend les commutateurs du pont dont le courant baisse d'un micro-pas
+ * à l'autre, comme commutationDeplacement().
+ * @param rapport Le rapport cyclique du micro-pas.
+ * @param precedent Celui du micro-pas précédent.
+ * @return 0x03, 0x0C ou 0.
+ */
+unsigned char tablePont(unsigned char rapport, unsigned char precedent) {
+    if (rapport < precedent) {
+        return 0x03;
+    }
+    if (rapport > precedent) {
+        return 0x0C;
+    }
+    return 0;
+}
+
+/**
+ * Calcule les tables de décroissance d'un jeu de tables, à refaire
+ * après chaque changement de ses rapports cycliques.
+ * @param t Le jeu de tables.
+ */
+void tablePrepare(struct TableCommutation *t) {
+    unsigned char n;
+
+    for (n = 0; n < 16; n++) {
+        t->pontAvant[n] = tablePont(t->cos[n], t->cos[(n - 1) & 0x0F]);
+        t->pontArriere[n] = tablePont(t->cos[n], t->cos[(n + 1) & 0x0F]);
+    }
+}
+
+#ifdef HACHAGE_MATERIEL
+#define CONSIGNE_RAPIDE(n) VREFCON2 = table->consigneCourant[n];
+#else
+#define CONSIGNE_RAPIDE(n)
+#endif
+
+/**
+ * Commutation d'un micro-pas dans un sens, développée sur place: fait
+ * la même chose que commutationDeplacement(), avec la décroissance
+ * prise dans les tables du sens.
+ * @param pas Position en cours dans la séquence de commutation.
+ * @param ponts pontAvant ou pontArriere.
+ */
+#define COMMUTATION_SENS(pas, ponts) { \
+    unsigned char n_; \
+    if (tableEchange && ((pas) & 0x07) == 0) { \
+        table = tableReserve(); \
+        tableEchange = 0; \
+        quadrant = QUADRANT_INCONNU; \
+    } \
+    n_ = (pas) & 0x0F; \
+    decroissance.pont = quadrant != QUADRANT_INCONNU ? table->ponts[n_] : 0; \
+    decroissance.rapport = table->cos[n_]; \
+    CCPR3L = decroissance.rapport; \
+    CONSIGNE_RAPIDE(n_) \
+    n_ = (pas) >> 3; \
+    if (n_ != quadrant) { \
+        quadrant = n_; \
+        PORTA = table->commutateurs[n_]; \
+    } \
+}
+#define COMMUTATION_AVANT(pas) COMMUTATION_SENS(pas, pontAvant)
+#define COMMUTATION_ARRIERE(pas) COMMUTATION_SENS(pas, pontArriere)
+#else
+#define COMMUTATION_AVANT(pas) commutationDeplacement(pas)
+#define COMMUTATION_ARRIERE(pas) commutationDeplacement(pas)
+#endif
+
+/**
+ * Taille du tampon circulaire de lecture, en échantillons; doit être
+ * une puissance de 2.
+ */
+#define TAILLE_LECTURE 64
+
+/**
+ * Tampon circulaire d'échantillons pour le mode lecture: la boucle
+ * principale le remplit avec les échantillons reçus par la liaison
+ * série, pendant que les interruptions en vident l'autre bout.
+ */
+static unsigned char lectureRapports[TAILLE_LECTURE];
+static unsigned char lectureCommutateurs[TAILLE_LECTURE];
+static volatile unsigned char lectureEntree = 0;
+static volatile unsigned char lectureSortie = 0;
+
+/**
+ * Bilan de la lecture en cours.
+ * Les compteurs sont tenus par les interruptions.
+ */
+static volatile struct {
+    /** Échantillons joués.*/
+    uint32_t joues;
+    /** Fois où le tampon était vide au moment de jouer.*/
+    uint16_t sousAlimentations;
+    /** 1 pendant le mode lecture.*/
+    unsigned char active;
+} lectureBilan;
+
+/**
+ * Configure le ECCP3 et le port A avec le prochain échantillon du mode
+ * lecture, à la place de la séquence de commutation. Si le tampon est
+ * vide, l'échantillon précédent reste en place.
+ * @return 0 si le tampon était vide.
+ */
+unsigned char commutationEchantillon() {
+    unsigned char n = lectureSortie;
+#ifdef HACHAGE_MATERIEL
+    unsigned char consigne;
+#endif
+
+    if (n == lectureEntree) {
+        lectureBilan.sousAlimentations++;
+        return 0;
+    }
+    CCPR3L = lectureRapports[n];
+#ifdef HACHAGE_MATERIEL
+    consigne = lectureRapports[n];
+    if (consigne < 16) {
+        consigne = 32 - consigne;
+    }
+    if (consigne > 31) {
+        consigne = 31;
+    }
+    VREFCON2 = consigne;
+#endif
+    PORTA = lectureCommutateurs[n];
+    quadrant = QUADRANT_INCONNU;
+    decroissance.pont = 0;
+    lectureSortie = (n + 1) & (TAILLE_LECTURE - 1);
+    lectureBilan.joues++;
+    return 1;
+}
+
+/**
+ * Coupe la puissance des ponts après une surintensité.
+ * Le matériel a déjà arrêté le ECCP3 (entrée FLT0); il s'agit
+ * seulement de l'empêcher de redémarrer tout seul.
+ */
+void commutationCoupure() {
+    PWM3CONbits.P3RSEN = 0;     // Pas de redémarrage automatique...
+    CCP3ASbits.CCP3ASE = 1;     // ... le ECCP3 reste arrêté.
+    PORTA = 0;                  // Tous les commutateurs ouverts.
+    quadrant = QUADRANT_INCONNU;
+    decroissance.pont = 0;
+    decroissance.phases = 0;
+}
+
+/**
+ * Rétablit la puissance des ponts après une coupure.
+ * Le port A est rétabli par la commutation suivante.
+ */
+void commutationRetablissement() {
+#ifdef HACHAGE_MATERIEL
+    PWM3CONbits.P3RSEN = 1;     // Le hachage a besoin du redémarrage.
+#endif
+    CCP3ASbits.CCP3ASE = 0;     // Relance le ECCP3.
+}
+
+/**
+ * Nombre de TICTAC d'attente avant de tenter un redémarrage
+ * après une surintensité.
+ */
+#define ATTENTE_RELANCE 8
+
+/**
+ * Nombre maximum de redémarrages consécutifs. Au-delà, le moteur
+ * reste coupé, sans interruptions du temporisateur 2, jusqu'au
+ * prochain ordre (COMMANDE_AVANCE, COMMANDE_RECULE, COMMANDE_ARRETE,
+ * COMMANDE_LECTURE ou COMMANDE_SUIVI), qui relance un cycle de
+ * redémarrages. Le moteur freine alors jusqu'au pas entier, comme
+ * après une surintensité; l'ordre est à renvoyer une fois à l'arrêt.
+ */
+#define RELANCES_MAX 3
+
+/**
+ * Nombre d'interruptions du temporisateur 2 par TICTAC.
+ */
+#define DIVISEUR_TICTAC 26
+
+/**
+ * Période des interruptions du temporisateur 2, en µs:
+ * (PR2 + 1) x pré-diviseur (4) x post-diviseur (9) x 4 / Fosc.
+ */
+#define PERIODE_TMR2_US ((32 + 1) * 4 * 9 * 4 / (_XTAL_FREQ / 1000000))
+
+/**
+ * Compte les interruptions du temporisateur 2 entre deux TICTAC.
+ */
+static unsigned char diviseurTictac = 0;
+
+/**
+ * Nombre d'interruptions du temporisateur 2 par TICTAC en cours.
+ */
+static unsigned char periodeTictac = DIVISEUR_TICTAC;
+
+/**
+ * Période des TICTAC demandée pour le mode lecture.
+ */
+static unsigned char periodeLecture;
+
+/**
+ * Taille de la file des pas du mode suivi; doit être une puissance de 2.
+ */
+#define TAILLE_SUIVI 32
+
+/**
+ * File des pas du mode suivi, remplie par la boucle principale à mesure
+ * qu'elle décode la trajectoire reçue. Chaque entrée contient le sens
+ * du pas (bit 7, 1 en marche arrière) et l'intervalle qui le sépare du
+ * pas précédent (bits 0 à 6), en interruptions du temporisateur 2.
+ */
+static unsigned char fileSuivi[TAILLE_SUIVI];
+static volatile unsigned char suiviEntree = 0;
+static volatile unsigned char suiviSortie = 0;
+
+/**
+ * État du mode suivi, partagé avec la boucle principale.
+ */
+static volatile struct {
+    /** Sens du pas en cours: 1 en marche arrière.*/
+    unsigned char sens;
+    /** 1 si la trajectoire est complètement reçue.*/
+    unsigned char fin;
+    /** 1 pendant le mode suivi.*/
+    unsigned char actif;
+} suivi;
+
+/**
+ * Prend le prochain pas de la file du mode suivi: son sens, et
+ * l'intervalle qui le sépare du pas qui vient d'être fait.
+ * @return 0 si la file est vide.
+ */
+unsigned char suiviSuivant() {
+    unsigned char n = suiviSortie;
+    unsigned char entree;
+
+    if (n == suiviEntree) {
+        return 0;
+    }
+    entree = fileSuivi[n];
+    suiviSortie = (n + 1) & (TAILLE_SUIVI - 1);
+    periodeTictac = entree & 0x7F;
+    suivi.sens = entree >> 7;
+    return 1;
+}
+
+/**
+ * Arrête les interruptions du temporisateur 2.
+ * À l'arrêt, la machine à états n'a rien à faire des TICTAC; le
+ * temporisateur 2 continue de tourner pour le PWM de stationnement.
+ */
+void tictacArrete() {
+    PIE1bits.TMR2IE = 0;
+}
+
+#ifdef SORTIE_EN_POSITION
+/**
+ * Interruptions du temporisateur 2 (4,752ms) entre la fin d'un
+ * freinage et la sortie «en position».
+ */
+static volatile unsigned char delaiEnPosition = 0;
+
+/**
+ * Interruptions restantes avant la sortie «en position», ou 0.
+ */
+static unsigned char attenteEnPosition = 0;
+
+/**
+ * Compte l'attente de la sortie «en position», à chaque interruption
+ * du temporisateur 2 qui suit l'entrée dans l'état ARRET: la sortie
+ * passe à 1 avec la dernière. Les interruptions, restées actives pour
+ * l'attente, s'arrêtent avec elle.
+ */
+void enPositionAttend() {
+    if (--attenteEnPosition == 0) {
+        SORTIE_EN_POSITION = 1;
+        PIE1bits.TMR2IE = 0;
+    }
+}
+#endif
+
+/**
+ * Entre dans l'état ARRET, quel que soit l'état d'où vient la machine:
+ * stationne sur le pas, arrête les interruptions du temporisateur 2 et
+ * signale que le moteur est en position. S'il faut attendre que le
+ * rotor se stabilise, les interruptions continuent pour l'attente
+ * (voir enPositionAttend).
+ * @param pas Position dans la séquence de commutation.
+ */
+void arretEntre(unsigned char pas) {
+    commutationStationnement(pas);
+#ifdef SORTIE_EN_POSITION
+    attenteEnPosition = delaiEnPosition;
+    if (attenteEnPosition) {
+        return;
+    }
+    SORTIE_EN_POSITION = 1;
+#endif
+    tictacArrete();
+}
+
+/**
+ * Relance les interruptions du temporisateur 2.
+ * Le drapeau, levé pendant l'arrêt, est ignoré: la première TICTAC
+ * arrive avec l'interruption suivante, au début d'une période PWM.
+ */
+void tictacDemarre() {
+#ifdef SORTIE_EN_POSITION
+    // Le moteur quitte sa position, même pendant l'attente:
+    SORTIE_EN_POSITION = 0;
+    if (attenteEnPosition) {
+        attenteEnPosition = 0;
+        PIE1bits.TMR2IE = 0;
+    }
+#endif
+    if (!PIE1bits.TMR2IE) {
+        diviseurTictac = 0;
+        PIR1bits.TMR2IF = 0;
+        PIE1bits.TMR2IE = 1;
+    }
+}
+
+/**
+ * Applique la décroissance lente: la bobine dont le courant baisse est
+ * court-circuitée par les commutateurs du bas de son pont.
+ */
+void decroissanceLente() {
+    CCPR3L = decroissance.rapport;
+    PORTA = table->commutateurs[quadrant] & ~decroissance.pont;
+}
+
+/**
+ * Démarre la décroissance du micro-pas qui vient d'être commuté, selon
+ * le mode en service. Le temporisateur 4 interrompt à la fin de chaque
+ * période du PWM tant qu'elle dure (voir decroissanceSuivante).
+ */
+void decroissanceDemarre() {
+    unsigned char mode = decroissanceMode;
+
+    if (mode == DECROISSANCE_AUCUNE) {
+        decroissance.pont = 0;
+        return;
+    }
+    decroissance.phases = 1;
+    if (mode == DECROISSANCE_MIXTE) {
+        decroissance.phases = 2;
+    }
+    if (mode == DECROISSANCE_LENTE) {
+        decroissanceLente();
+    } else if (decroissance.pont == 0x03) {
+        CCPR3L = 0;
+    } else {
+        CCPR3L = RAPPORT_PLEIN;
+    }
+    PIR5bits.TMR4IF = 0;
+    PIE5bits.TMR4IE = 1;
+}
+
+/**
+ * Passe à la phase suivante de la décroissance en cours, à la fin
+ * d'une période du PWM. Après la dernière, revient à la commutation
+ * normale et arrête les interruptions du temporisateur 4. Une
+ * décroissance interrompue (phases à 0) les arrête seulement.
+ */
+void decroissanceSuivante() {
+    if (decroissance.phases > 1) {
+        // Deuxième phase du mode mixte:
+        decroissance.phases--;
+        decroissanceLente();
+        return;
+    }
+    if (decroissance.phases) {
+        CCPR3L = decroissance.rapport;
+        PORTA = table->commutateurs[quadrant];
+        decroissance.pont = 0;
+        decroissance.phases = 0;
+    }
+    PIE5bits.TMR4IE = 0;
+}
+
+/**
+ * Liste d'états pour la machine à états.
+ */
+enum Etat {
+    /** Le moteur est à l'arrêt, sur un pas entier.*/
+    ARRET,
+    /** Le moteur avance. */
+    MARCHE_AVANT,
+    /** Le moteur va s'arrêter dès qu'il atteint un pas complet.*/
+    FREIN_AVANT,
+    /** Le moteur recule. */
+    MARCHE_ARRIERE,
+    /** Le moteur va s'arrêter dès qu'il atteint un pas complet.*/
+    FREIN_ARRIERE,
+    /** Les ponts sont coupés suite à une surintensité.*/
+    DEFAUT,
+    /** Le moteur joue les échantillons reçus par la liaison série.*/
+    LECTURE,
+    /** Le moteur suit la trajectoire reçue par la liaison série.*/
+    SUIVI
+};
+
+/**
+ * Liste d'événements pour la machine à états.
+ */
+enum Evenement {
+    /** Le moteur doit avancer.*/
+    AVANCE,
+    /** Le moteur doit reculer.*/
+    RECULE,
+    /** Le moteur doit s'arrêter.*/
+    ARRETE,
+    /** Suivante �tape dans la séquence.*/
+    TICTAC,
+    /** Les ponts sont en surintensité.*/
+    SURINTENSITE,
+    /** Le moteur doit jouer les échantillons reçus.*/
+    LIS,
+    /** Le moteur doit suivre la trajectoire reçue.*/
+    SUIS,
+#ifdef CAPTEUR_INDEX
+    /** La position doit être corrigée des pas perdus.*/
+    CORRIGE
+#endif
+};
+
+/**
+ * Compte rendu du mouvement en cours, tenu par la machine à états et
+ * exploité par la boucle principale pour les statistiques.
+ * Les compteurs d'événements tournent librement modulo 256; la boucle
+ * principale n'en retient que la différence.
+ */
+static volatile struct {
+    /** Incrémenté au début de chaque mouvement.*/
+    unsigned char numero;
+    /** Numéro du dernier mouvement terminé.*/
+    unsigned char termine;
+    /** 1 si le mouvement est en marche arrière.*/
+    unsigned char arriere;
+    /** Micro-pas effectués depuis le début du mouvement.*/
+    uint16_t microPas;
+    /** Somme des intervalles prévus entre ces micro-pas, en
+     * interruptions du temporisateur 2: DIVISEUR_TICTAC, ou ceux de
+     * la trajectoire en mode suivi. Le premier micro-pas vient dès la
+     * première interruption: son intervalle est déduit d'avance.*/
+    uint32_t prevu;
+    /** Nombre de freinages.*/
+    unsigned char freinages;
+    /** Nombre de surintensités.*/
+    unsigned char defauts;
+    /** État de la machine (voir Etat).*/
+    unsigned char etat;
+    /** Position absolue, en micro-pas.*/
+    int32_t position;
+} mouvement;
+
+#ifdef CAPTEUR_INDEX
+/**
+ * Impulsion du capteur d'index, relevée par les interruptions de haute
+ * priorité. La boucle principale la reprend quand pret vaut 1; jusque
+ * là, les impulsions suivantes sont ignorées.
+ */
+static volatile struct {
+    /** Position au front montant.*/
+    int32_t debut;
+    /** Somme des positions aux deux fronts, soit le double du milieu.*/
+    int32_t milieuDouble;
+    /** 1 entre le front montant et le front descendant.*/
+    unsigned char ouverte;
+    /** 1 si milieuDouble attend la boucle principale.*/
+    unsigned char pret;
+    /** Correction demandée par la boucle principale, en micro-pas;
+     * remise à 0 quand elle est appliquée.*/
+    int16_t correction;
+} capteurIndex;
+
+/**
+ * Relève la position à un front du capteur d'index.
+ * Le milieu de l'impulsion ne dépend pas du sens de rotation, alors que
+ * chaque front est décalé de la largeur de l'impulsion.
+ * @param niveau Niveau du capteur après le front.
+ */
+void indexFront(unsigned char niveau) {
+    if (niveau) {
+        capteurIndex.debut = mouvement.position;
+        capteurIndex.ouverte = 1;
+    } else if (capteurIndex.ouverte) {
+        if (!capteurIndex.pret) {
+            capteurIndex.milieuDouble =
+                    capteurIndex.debut + mouvement.position;
+            capteurIndex.pret = 1;
+        }
+        capteurIndex.ouverte = 0;
+    }
+}
+#endif
+
+/**
+ * Codes des défauts enregistrés dans le journal.
+ */
+enum CodeDefaut {
+    /** Surintensité dans les ponts.*/
+    DEFAUT_SURINTENSITE = 1,
+    /** Surintensité après le dernier redémarrage autorisé.*/
+    DEFAUT_ABANDON,
+    /** Tampon du mode lecture vide au moment de jouer.*/
+    DEFAUT_SOUS_ALIMENTATION
+};
+
+/**
+ * Millisecondes écoulées depuis le démarrage.
+ * Il faut la lire avec tempsEcoule().
+ */
+static volatile uint32_t millisecondes = 0;
+
+/**
+ * Copies de millisecondes pour les interruptions de haute priorité, qui
+ * peuvent arriver au milieu de son incrément. Celles de basse priorité
+ * écrivent la copie qui n'est pas à l'index, puis changent l'index:
+ * la copie à l'index est toujours complète (voir journalDefaut).
+ */
+static uint32_t horloges[2];
+static volatile unsigned char horloge = 0;
+
+/**
+ * Entrée du journal des défauts.
+ * Les champs de 32 bits viennent en premier, pour que la structure
+ * n'ait pas de trous.
+ */
+struct EntreeJournal {
+    /** Millisecondes depuis le démarrage.*/
+    uint32_t temps;
+    /** Position absolue, en micro-pas.*/
+    int32_t position;
+    /** Code du défaut (voir CodeDefaut).*/
+    unsigned char code;
+    /** État de la machine (voir Etat).*/
+    unsigned char etat;
+    /** Position dans la séquence de commutation.*/
+    unsigned char pas;
+    /** Dernière commande reçue (voir Evenement).*/
+    unsigned char commande;
+};
+
+/**
+ * Nombre de défauts pouvant attendre leur écriture dans le journal.
+ */
+#define TAILLE_DEFAUTS 4
+
+/**
+ * Défauts en attente d'écriture dans le journal. La machine à états
+ * les dépose horodatés, sans attendre, et la boucle principale les
+ * copie dans l'EEPROM.
+ */
+static struct EntreeJournal defautsEnAttente[TAILLE_DEFAUTS];
+static volatile unsigned char defautsEntree = 0;
+static volatile unsigned char defautsSortie = 0;
+
+/**
+ * Dépose un défaut en attente d'écriture dans le journal, avec l'heure
+ * à laquelle il arrive. Si la file est pleine, le défaut est perdu.
+ * L'heure est lue dans horloges, qui ne change pas pendant la machine à
+ * états.
+ * @param code Code du défaut.
+ * @param etat État de la machine.
+ * @param pas Position dans la séquence de commutation.
+ * @param position Position absolue.
+ * @param commande Dernière commande reçue.
+ */
+void journalDefaut(enum CodeDefaut code, enum Etat etat, unsigned char pas,
+        int32_t position, enum Evenement commande) {
+    struct EntreeJournal *entree;
+    unsigned char suivant;
+
+    suivant = (defautsEntree + 1) & (TAILLE_DEFAUTS - 1);
+    if (suivant == defautsSortie) {
+        return;
+    }
+    entree = &defautsEnAttente[defautsEntree];
+    entree->temps = horloges[horloge];
+    entree->code = code;
+    entree->etat = etat;
+    entree->pas = pas;
+    entree->position = position;
+    entree->commande = commande;
+    defautsEntree = suivant;
+}
+
+/**
+ * Machine à états.
+ * @param evenement L'événement à gérer.
+ */
+void machine(enum Evenement evenement) {
+    // État principal de la machine.
+    static enum Etat etat = ARRET;
+
+    // Position dans la séquence de commutation, entre 0 et 31.
+    static unsigned char pas = 0;
+
+    // État au moment de la surintensité.
+    static enum Etat etatDefaut;
+
+    // TICTAC restant avant la tentative de redémarrage.
+    static unsigned char attente;
+
+    // Redémarrages effectués depuis le dernier ordre de marche.
+    static unsigned char relances = 0;
+
+    // Position absolue, en micro-pas.
+    static int32_t position = 0;
+
+    // Dernière commande reçue.
+    static enum Evenement commande = ARRETE;
+
+    switch(evenement) {
+        case AVANCE:
+        case RECULE:
+        case ARRETE:
+        case LIS:
+        case SUIS:
+            commande = evenement;
+            break;
+    }
+
+#ifdef CAPTEUR_INDEX
+    // La position n'est corrigée qu'à l'arrêt. Une impulsion relevée
+    // avant la correction est oubliée:
+    if (evenement == CORRIGE) {
+        if (etat == ARRET) {
+            position -= capteurIndex.correction;
+            mouvement.position = position;
+            capteurIndex.correction = 0;
+            capteurIndex.ouverte = 0;
+            capteurIndex.pret = 0;
+        }
+        return;
+    }
+#endif
+
+    // Une surintensité coupe les ponts quel que soit l'état.
+    // La position dans la séquence est conservée pour le redémarrage:
+    if (evenement == SURINTENSITE) {
+        commutationCoupure();
+        mouvement.defauts++;
+        journalDefaut(DEFAUT_SURINTENSITE, etat, pas, position, commande);
+        if (relances >= RELANCES_MAX) {
+            journalDefaut(DEFAUT_ABANDON, etat, pas, position, commande);
+        }
+        if (etat != DEFAUT) {
+            etatDefaut = etat;
+        }
+        attente = ATTENTE_RELANCE;
+        etat = DEFAUT;
+        periodeTictac = DIVISEUR_TICTAC;
+        lectureBilan.active = 0;
+        suivi.actif = 0;
+        tictacDemarre();
+        // Abandon: les ponts restent coupés, sans TICTAC.
+        if (relances >= RELANCES_MAX) {
+            tictacArrete();
+        }
+        mouvement.etat = etat;
+        return;
+    }
+
+    switch(etat) {
+        case ARRET:
+            switch(evenement) {
+                case AVANCE:
+                    relances = 0;
+                    mouvement.arriere = 0;
+                    mouvement.microPas = 0;
+                    mouvement.prevu = 0 - (uint32_t) periodeTictac;
+                    mouvement.numero++;
+                    etat = MARCHE_AVANT;
+                    tictacDemarre();
+                    break;
+                case RECULE:
+                    relances = 0;
+                    mouvement.arriere = 1;
+                    mouvement.microPas = 0;
+                    mouvement.prevu = 0 - (uint32_t) periodeTictac;
+                    mouvement.numero++;
+                    etat = MARCHE_ARRIERE;
+                    tictacDemarre();
+                    break;
+                case LIS:
+                    lectureBilan.joues = 0;
+                    lectureBilan.sousAlimentations = 0;
+                    lectureBilan.active = 1;
+                    periodeTictac = periodeLecture;
+                    etat = LECTURE;
+                    tictacDemarre();
+                    break;
+                case SUIS:
+                    if (suiviSuivant()) {
+                        relances = 0;
+                        mouvement.arriere = suivi.sens;
+                        mouvement.microPas = 0;
+                        mouvement.prevu = 0 - (uint32_t) periodeTictac;
+                        mouvement.numero++;
+                        suivi.actif = 1;
+                        etat = SUIVI;
+                        tictacDemarre();
+                    }
+                    break;
+            }
+            break;
+
+        // Le moteur avance en suivant la séquence de commutation
+        // jusqu'à ce qu'il reçoive l'ordre de s'arrêter.
+        case MARCHE_AVANT:
+            switch(evenement) {
+                case TICTAC:
+                    COMMUTATION_AVANT(pas);
+                    mouvement.microPas++;
+                    mouvement.prevu += periodeTictac;
+                    position++;
+                    pas++;
+                    if (pas > 31) {
+                        pas = 0;
+                    }
+                    break;
+                case RECULE:
+                case ARRETE:
+                    mouvement.freinages++;
+                    etat = FREIN_AVANT;
+                    break;
+            }
+            break;
+
+        // Le moteur continue d'avancer jusqu'à ce qu'il
+        // arrive sur un pas entier.
+        case FREIN_AVANT:
+            switch(evenement) {
+                case TICTAC:
+                    switch(pas) {
+                        case 0:
+                        case 8:
+                        case 16:
+                        case 24:
+                            mouvement.termine = mouvement.numero;
+                            etat = ARRET;
+                            arretEntre(pas);
+                            break;
+                        default:
+                            COMMUTATION_AVANT(pas);
+                            mouvement.microPas++;
+                            mouvement.prevu += periodeTictac;
+                            position++;
+                            pas++;
+                            if (pas > 31) {
+                                pas = 0;
+                            }
+                            break;
+                    }
+                    break;
+            }
+            break;
+        case MARCHE_ARRIERE:
+            switch(evenement) {
+                case TICTAC:
+                    COMMUTATION_ARRIERE(pas);
+                    mouvement.microPas++;
+                    mouvement.prevu += periodeTictac;
+                    position--;
+                    pas--;
+                    if (pas > 31) {
+                        pas = 31;
+                    }
+                    break;
+                case AVANCE:
+                case ARRETE:
+                    mouvement.freinages++;
+                    etat = FREIN_ARRIERE;
+                    break;
+            }
+            break;
+
+        // Le moteur continue de reculer jusqu'à ce qu'il
+        // arrive sur un pas entier.
+        case FREIN_ARRIERE:
+            switch(evenement) {
+                case TICTAC:
+                    switch(pas) {
+                        case 0:
+                        case 8:
+                        case 16:
+                        case 24:
+                            mouvement.termine = mouvement.numero;
+                            etat = ARRET;
+                            arretEntre(pas);
+                            break;
+                        default:
+                            COMMUTATION_ARRIERE(pas);
+                            mouvement.microPas++;
+                            mouvement.prevu += periodeTictac;
+                            position--;
+                            pas--;
+                            if (pas > 31) {
+                                pas = 31;
+                            }
+                            break;
+                    }
+                    break;
+            }
+            break;
+
+        // Les ponts sont coupés. Après une attente, si l'entrée de défaut
+        // est revenue au repos, les ponts sont rétablis sur le micro-pas
+        // où ils ont été coupés, et le moteur freine dans son sens de
+        // marche jusqu'au pas entier suivant. Après RELANCES_MAX
+        // redémarrages, la machine attend sans TICTAC un ordre qui
+        // relance les redémarrages.
+        case DEFAUT:
+            switch(evenement) {
+                case AVANCE:
+                case RECULE:
+                case ARRETE:
+                case LIS:
+                case SUIS:
+                    if (relances >= RELANCES_MAX) {
+                        relances = 0;
+                        attente = 0;
+                        tictacDemarre();
+                    }
+                    break;
+                case TICTAC:
+                    if (attente > 0) {
+                        attente--;
+                    } else if (relances < RELANCES_MAX && PORTBbits.RB0) {
+                        relances++;
+                        commutationRetablissement();
+                        switch(etatDefaut) {
+                            case LECTURE:
+                                etat = ARRET;
+                                arretEntre(pas);
+                                break;
+                            case SUIVI:
+                                if (suivi.sens) {
+                                    etat = FREIN_ARRIERE;
+                                } else {
+                                    etat = FREIN_AVANT;
+                                }
+                                break;
+                            case MARCHE_ARRIERE:
+                            case FREIN_ARRIERE:
+                                etat = FREIN_ARRIERE;
+                                break;
+                            default:
+                                etat = FREIN_AVANT;
+                                break;
+                        }
+                    }
+                    break;
+            }
+            break;
+
+        // Le moteur joue les échantillons reçus, jusqu'à ce qu'il
+        // reçoive l'ordre de s'arrêter. Il revient alors sur la
+        // position de stationnement qu'il avait avant la lecture, et
+        // les échantillons restants sont abandonnés.
+        case LECTURE:
+            switch(evenement) {
+                case TICTAC:
+                    if (!commutationEchantillon()
+                            && lectureBilan.sousAlimentations == 1) {
+                        journalDefaut(DEFAUT_SOUS_ALIMENTATION,
+                                etat, pas, position, commande);
+                    }
+                    break;
+                case ARRETE:
+                    periodeTictac = DIVISEUR_TICTAC;
+                    lectureBilan.active = 0;
+                    lectureSortie = lectureEntree;
+                    etat = ARRET;
+                    arretEntre(pas);
+                    break;
+            }
+            break;
+
+        // Le moteur fait chaque pas de la file dans le sens indiqué,
+        // et attend l'intervalle indiqué avant le suivant. Quand la
+        // file est vide, ou sur ordre, il freine jusqu'au pas entier
+        // suivant à la vitesse normale.
+        // Le pas avance avant la commutation: le micro-pas commuté est
+        // celui de la position, dès le premier pas et à chaque
+        // changement de sens.
+        case SUIVI:
+            switch(evenement) {
+                case TICTAC:
+                    mouvement.microPas++;
+                    mouvement.prevu += periodeTictac;
+                    if (suivi.sens) {
+                        position--;
+                        pas--;
+                        if (pas > 31) {
+                            pas = 31;
+                        }
+                        COMMUTATION_ARRIERE(pas);
+                    } else {
+                        position++;
+                        pas++;
+                        if (pas > 31) {
+                            pas = 0;
+                        }
+                        COMMUTATION_AVANT(pas);
+                    }
+                    if (!suiviSuivant()) {
+                        if (!suivi.fin) {
+                            journalDefaut(DEFAUT_SOUS_ALIMENTATION,
+                                    etat, pas, position, commande);
+                        }
+                        periodeTictac = DIVISEUR_TICTAC;
+                        suivi.actif = 0;
+                        if (suivi.sens) {
+                            etat = FREIN_ARRIERE;
+                        } else {
+                            etat = FREIN_AVANT;
+                        }
+                    }
+                    break;
+                case ARRETE:
+                    mouvement.freinages++;
+                    periodeTictac = DIVISEUR_TICTAC;
+                    suivi.actif = 0;
+                    if (suivi.sens) {
+                        etat = FREIN_ARRIERE;
+                    } else {
+                        etat = FREIN_AVANT;
+                    }
+                    break;
+            }
+            break;
+    }
+
+    mouvement.etat = etat;
+    mouvement.position = position;
+}
+
+/**
+ * Rend la distance de freinage: les micro-pas que le moteur fera encore
+ * si l'ordre de s'arrêter arrive maintenant.
+ * Le freinage n'a pas de rampe: le moteur termine le pas entier en
+ * cours, à la vitesse normale. La distance ne dépend donc pas de la
+ * vitesse, seulement du sens et de la position dans le pas entier;
+ * pas et position sont égaux modulo 32.
+ * @param etat L'état de la machine (voir Etat).
+ * @param sens Le sens du mode suivi (voir suivi).
+ * @param position La position absolue, en micro-pas.
+ * @return La distance, négative en marche arrière. 0 hors des états
+ * de marche et de freinage.
+ */
+signed char freinageDistance(unsigned char etat, unsigned char sens,
+        unsigned char position) {
+    switch (etat) {
+        case SUIVI:
+            if (sens) {
+                return -(position & 7);
+            }
+            // Continue sur MARCHE_AVANT.
+        case MARCHE_AVANT:
+        case FREIN_AVANT:
+            return -position & 7;
+        case MARCHE_ARRIERE:
+        case FREIN_ARRIERE:
+            return -(position & 7);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Rend la durée du freinage, si l'ordre de s'arrêter arrive maintenant.
+ * Le premier TICTAC vient dès que le compteur atteint DIVISEUR_TICTAC,
+ * période à laquelle le freinage ramène le mode suivi. Chaque micro-pas
+ * de la distance en demande ensuite un, avant le stationnement.
+ * @param distance La distance de freinage (voir freinageDistance).
+ * @param diviseur La valeur de diviseurTictac.
+ * @return La durée, en interruptions du temporisateur 2.
+ */
+unsigned char freinageDuree(signed char distance, unsigned char diviseur) {
+    unsigned char premier = 1;
+
+    if (distance < 0) {
+        distance = -distance;
+    }
+    if (diviseur != 0) {
+        premier++;
+        if (diviseur < DIVISEUR_TICTAC) {
+            premier += DIVISEUR_TICTAC - 1 - diviseur;
+        }
+    }
+    return premier + distance * DIVISEUR_TICTAC;
+}
+
+/**
+ * Valeur à ajouter au temporisateur 0 à chaque débordement pour qu'il
+ * déborde toutes les millisecondes. L'écriture de TMR0L suspend le
+ * comptage pendant 2 cycles, qu'il faut compenser.
+ */
+#define RECHARGE_TMR0 (256 - _XTAL_FREQ / 4 / 1000 + 2)
+
+/**
+ * Rend le nombre de millisecondes écoulées depuis le démarrage.
+ * Les interruptions de basse priorité sont suspendues pendant la
+ * lecture, ce qui ne retarde pas les pas du moteur.
+ * À n'appeler que depuis la boucle principale.
+ * @return Le nombre de millisecondes.
+ */
+uint32_t tempsEcoule() {
+    uint32_t t;
+
+    INTCONbits.GIEL = 0;
+    t = millisecondes;
+    INTCONbits.GIEL = 1;
+    return t;
+}
+
+/**
+ * Valeur du générateur de bauds pour la liaison série à 9600 bauds,
+ * avec BRG16 = 1 et BRGH = 1.
+ */
+#define VITESSE_SERIE (_XTAL_FREQ / 4 / 9600 - 1)
+
+/**
+ * Taille des tampons de la liaison série; doit être une puissance de 2.
+ */
+#define TAILLE_RECEPTION 128
+#define TAILLE_EMISSION 64
+
+/**
+ * Tampon circulaire de réception, rempli par les interruptions.
+ */
+static volatile unsigned char reception[TAILLE_RECEPTION];
+static volatile unsigned char receptionEntree = 0;
+static volatile unsigned char receptionSortie = 0;
+
+/**
+ * Valeur de millisecondes à la réception du dernier octet.
+ */
+static volatile uint32_t derniereReception = 0;
+
+/**
+ * Tampon circulaire d'émission, vidé par les interruptions.
+ */
+static volatile unsigned char emission[TAILLE_EMISSION];
+static volatile unsigned char emissionEntree = 0;
+static volatile unsigned char emissionSortie = 0;
+
+/**
+ * Indique si des octets reçus attendent d'être lus.
+ * @return 1 s'il y a au moins un octet à lire.
+ */
+unsigned char serieDisponible() {
+    return receptionEntree != receptionSortie;
+}
+
+/**
+ * Lit le prochain octet reçu. Il faut vérifier avant avec
+ * serieDisponible() qu'il y en a un.
+ * @return L'octet.
+ */
+unsigned char serieLit() {
+    unsigned char octet;
+
+    octet = reception[receptionSortie];
+    receptionSortie = (receptionSortie + 1) & (TAILLE_RECEPTION - 1);
+    return octet;
+}
+
+/**
+ * Rend le temps écoulé depuis la réception du dernier octet, même s'il
+ * n'est pas encore lu. Comme tempsEcoule(), à n'appeler que depuis la
+ * boucle principale.
+ * @return Le temps, en millisecondes.
+ */
+uint32_t serieSilence() {
+    uint32_t t;
+
+    INTCONbits.GIEL = 0;
+    t = millisecondes - derniereReception;
+    INTCONbits.GIEL = 1;
+    return t;
+}
+
+/**
+ * Envoie un octet, s'il reste de la place dans le tampon d'émission.
+ * N'attend jamais. À n'appeler que depuis la boucle principale.
+ * @param octet L'octet.
+ * @return 0 si le tampon est plein: l'octet n'est pas envoyé.
+ */
+unsigned char serieEcrit(unsigned char octet) {
+    unsigned char suivant;
+
+    suivant = (emissionEntree + 1) & (TAILLE_EMISSION - 1);
+    if (suivant == emissionSortie) {
+        return 0;
+    }
+    emission[emissionEntree] = octet;
+    emissionEntree = suivant;
+    PIE3bits.TX2IE = 1;
+    return 1;
+}
+
+/**
+ * Interruptions de basse priorité.
+ */
+void interrupt low_priority interruptionsBP() {
+    unsigned char suivant;
+
+    if (INTCONbits.TMR0IF) {
+        INTCONbits.TMR0IF = 0;
+        TMR0L += RECHARGE_TMR0;
+        millisecondes++;
+        suivant = horloge ^ 1;
+        horloges[suivant] = millisecondes;
+        horloge = suivant;
+    }
+
+    // Réception d'un octet. S'il n'y a pas de place, il est perdu:
+    if (PIR3bits.RC2IF) {
+        suivant = (receptionEntree + 1) & (TAILLE_RECEPTION - 1);
+        reception[receptionEntree] = RCREG2;
+        derniereReception = millisecondes;
+        if (suivant != receptionSortie) {
+            receptionEntree = suivant;
+        }
+        if (RCSTA2bits.OERR) {
+            RCSTA2bits.CREN = 0;
+            RCSTA2bits.CREN = 1;
+        }
+    }
+
+    // Émission du prochain octet:
+    if (PIE3bits.TX2IE && PIR3bits.TX2IF) {
+        if (emissionSortie != emissionEntree) {
+            TXREG2 = emission[emissionSortie];
+            emissionSortie = (emissionSortie + 1) & (TAILLE_EMISSION - 1);
+        } else {
+            PIE3bits.TX2IE = 0;
+        }
+    }
+}
+
+/**
+ * Interruptions.
+ */
+void interrupt interruptionsHP() {
+
+    // La surintensité passe avant tout le reste:
+    if (INTCONbits.INT0IF) {
+        INTCONbits.INT0IF = 0;
+        machine(SURINTENSITE);
+    }
+
+    // Détecte de quel type d'interruption il s'agit:
+    if (PIE1bits.TMR2IE && PIR1bits.TMR2IF) {
+        PIR1bits.TMR2IF = 0;
+#ifdef SORTIE_EN_POSITION
+        // Avant la TICTAC: l'attente commence à l'interruption qui suit
+        // l'entrée dans l'état ARRET.
+        if (attenteEnPosition) {
+            enPositionAttend();
+        }
+#endif
+        if (diviseurTictac == 0) {
+            machine(TICTAC);
+            if (decroissance.pont) {
+                decroissanceDemarre();
+            }
+        }
+        diviseurTictac++;
+        if (diviseurTictac >= periodeTictac) {
+            diviseurTictac = 0;
+        }
+    }
+
+    // Fin d'une période du PWM pendant une décroissance:
+    if (PIE5bits.TMR4IE && PIR5bits.TMR4IF) {
+        PIR5bits.TMR4IF = 0;
+        decroissanceSuivante();
+    }
+
+#ifdef CAPTEUR_INDEX
+    // La lecture du port B termine le changement signalé par RBIF:
+    if (INTCONbits.RBIF) {
+        indexFront(PORTBbits.RB4);
+        INTCONbits.RBIF = 0;
+    }
+#endif
+
+    // Détecte de quel type d'interruption il s'agit:
+    if (INTCON3bits.INT2IF) {
+        INTCON3bits.INT2IF=0;
+        machine(AVANCE);
+    }
+    if (INTCON3bits.INT1IF) {
+        INTCON3bits.INT1IF = 0;
+        machine(RECULE);
+    }
+}
+
+/**
+ * Adresse EEPROM de la prochaine écriture.
+ */
+static unsigned char eepromAdresse;
+
+/**
+ * Prochain octet à copier vers l'EEPROM.
+ */
+static const unsigned char *eepromSource;
+
+/**
+ * Nombre d'octets restant à copier vers l'EEPROM.
+ */
+static unsigned char eepromRestant = 0;
+
+/**
+ * Lit un octet de l'EEPROM.
+ * Si une écriture est en cours, attend qu'elle se termine.
+ * @param adresse Adresse de l'octet.
+ * @return La valeur de l'octet.
+ */
+unsigned char eepromLit(unsigned char adresse) {
+    while (EECON1bits.WR);      // Attend la fin d'une écriture.
+    EEADR = adresse;
+    EECON1bits.EEPGD = 0;       // Accès à l'EEPROM...
+    EECON1bits.CFGS = 0;        // ... et non à la flash.
+    EECON1bits.RD = 1;
+    return EEDATA;
+}
+
+/**
+ * Lit un bloc de l'EEPROM.
+ * @param adresse Adresse du bloc.
+ * @param destination Où copier le bloc.
+ * @param longueur Longueur du bloc.
+ */
+void eepromLitBloc(unsigned char adresse, void *destination,
+        unsigned char longueur) {
+    unsigned char *d = destination;
+
+    while (longueur--) {
+        *d++ = eepromLit(adresse++);
+    }
+}
+
+/**
+ * Commence la copie d'un bloc de mémoire vers l'EEPROM.
+ * La copie se fait ensuite octet par octet avec eepromTache(); le bloc
+ * ne doit pas être modifié tant que eepromOccupee() rend 1.
+ * @param adresse Adresse de destination dans l'EEPROM.
+ * @param source Bloc à copier.
+ * @param longueur Longueur du bloc.
+ * @return 0 si une copie est déjà en cours, 1 sinon.
+ */
+unsigned char eepromCopie(unsigned char adresse, const void *source,
+        unsigned char longueur) {
+    if (eepromRestant) {
+        return 0;
+    }
+    eepromAdresse = adresse;
+    eepromSource = source;
+    eepromRestant = longueur;
+    return 1;
+}
+
+/**
+ * Indique si une copie vers l'EEPROM est en cours.
+ * @return 1 si une copie est en cours.
+ */
+unsigned char eepromOccupee() {
+    return eepromRestant != 0;
+}
+
+/**
+ * Avance d'un octet la copie en cours, si l'EEPROM a fini l'écriture
+ * précédente. Ne bloque jamais: une écriture prend environ 4ms, qui se
+ * déroulent pendant que la boucle principale fait autre chose.
+ * Les octets inchangés ne sont pas réécrits, pour ménager l'EEPROM.
+ * À appeler depuis la boucle principale.
+ */
+void eepromTache() {
+    unsigned char octet;
+
+    if (eepromRestant == 0 || EECON1bits.WR) {
+        return;
+    }
+    octet = *eepromSource;
+    if (eepromLit(eepromAdresse) != octet) {
+        EEDATA = octet;
+        EECON1bits.WREN = 1;
+        // La séquence de déverrouillage ne supporte pas d'interruption;
+        // elle ne retarde les pas que de quelques cycles:
+        INTCONbits.GIEH = 0;
+        EECON2 = 0x55;
+        EECON2 = 0xAA;
+        EECON1bits.WR = 1;
+        INTCONbits.GIEH = 1;
+        EECON1bits.WREN = 0;
+    }
+    eepromSource++;
+    eepromAdresse++;
+    eepromRestant--;
+}
+
+/**
+ * Statistiques de vie du moteur, conservées en EEPROM.
+ */
+struct Statistiques {
+    /** Version du format; une EEPROM vierge contient 0xFF.*/
+    unsigned char version;
+    /** Micro-pas en marche avant.*/
+    uint32_t microPasAvant;
+    /** Micro-pas en marche arrière.*/
+    uint32_t microPasArriere;
+    /** Temps passé en mouvement, en ms.*/
+    uint32_t dureeMouvements;
+    /** Nombre de mouvements.*/
+    uint16_t mouvements;
+    /** Nombre de freinages.*/
+    uint16_t freinages;
+    /** Nombre de surintensités.*/
+    uint16_t defauts;
+    /** Vitesse moyenne du mouvement le plus rapide, en micro-pas/s.*/
+    uint16_t vitesseMax;
+};
+
+/**
+ * Version du format des statistiques.
+ */
+#define VERSION_STATISTIQUES 1
+
+/**
+ * Adresse des statistiques dans l'EEPROM.
+ */
+#define EEPROM_STATISTIQUES 0x00
+
+/**
+ * Intervalle minimum entre deux sauvegardes des statistiques, en ms:
+ * 15 minutes. Une cellule de l'EEPROM tient au moins 100000 écritures,
+ * soit près de 3 ans d'écritures toutes les 15 minutes, jour et nuit;
+ * une coupure d'alimentation perd au plus les 15 dernières minutes.
+ * Un défaut est sauvegardé sans attendre (voir statistiquesTache).
+ */
+#define PERIODE_SAUVEGARDE 900000
+
+/**
+ * Statistiques en cours.
+ */
+static struct Statistiques statistiques;
+
+/**
+ * Copie des statistiques en cours d'écriture dans l'EEPROM.
+ */
+static struct Statistiques statistiquesSauvegardees;
+
+/**
+ * Bilan du dernier mouvement terminé.
+ */
+static struct {
+    /** Nombre de micro-pas.*/
+    uint16_t microPas;
+    /** Durée prévue par les intervalles entre les pas, à la vitesse
+     * nominale ou selon la trajectoire, en ms.*/
+    uint32_t dureePrevue;
+    /** Durée mesurée, en ms.*/
+    uint32_t dureeReelle;
+} dernierMouvement;
+
+/**
+ * Récupère les statistiques depuis l'EEPROM, ou les remet à zéro si
+ * l'EEPROM ne contient pas de statistiques valides.
+ */
+void statistiquesInitialise() {
+    unsigned char *s = (unsigned char *) &statistiques;
+    unsigned char n;
+
+    eepromLitBloc(EEPROM_STATISTIQUES, s, sizeof(statistiques));
+    if (statistiques.version != VERSION_STATISTIQUES) {
+        for (n = 0; n < sizeof(statistiques); n++) {
+            s[n] = 0;
+        }
+        statistiques.version = VERSION_STATISTIQUES;
+    }
+}
+
+/**
+ * Met à jour les statistiques d'après le compte rendu de la machine à
+ * états, et les sauvegarde périodiquement dans l'EEPROM pendant que le
+ * moteur est à l'arrêt, ou dès qu'une surintensité le met en défaut.
+ * À appeler depuis la boucle principale.
+ */
+void statistiquesTache() {
+    static unsigned char numero = 0;
+    static unsigned char enCours = 0;
+    static unsigned char freinages = 0;
+    static unsigned char defauts = 0;
+    static unsigned char modifiees = 0;
+    static unsigned char urgentes = 0;
+    static uint32_t debut;
+    static uint32_t sauvegarde = 0;
+
+    uint32_t maintenant = tempsEcoule();
+    uint32_t vitesse, prevu;
+    uint16_t microPas;
+    unsigned char n, termine, arriere;
+
+    // Le compte rendu du mouvement change dans les interruptions: il est
+    // copié d'un coup, pour que les micro-pas et le sens soient ceux du
+    // mouvement terminé, et que les 2 octets des micro-pas aillent
+    // ensemble.
+    INTCONbits.GIEH = 0;
+    n = mouvement.numero;
+    termine = mouvement.termine;
+    microPas = mouvement.microPas;
+    prevu = mouvement.prevu;
+    arriere = mouvement.arriere;
+    INTCONbits.GIEH = 1;
+
+    // Début de mouvement:
+    if (n != numero) {
+        numero = n;
+        enCours = 1;
+        debut = maintenant;
+        statistiques.mouvements++;
+        modifiees = 1;
+    }
+
+    // Fin de mouvement:
+    if (enCours && termine == numero) {
+        enCours = 0;
+        dernierMouvement.microPas = microPas;
+        dernierMouvement.dureeReelle = maintenant - debut;
+        // En ms: PERIODE_TMR2_US / 8 tient 2^32 / 594 interruptions, 9h:
+        dernierMouvement.dureePrevue = prevu * (PERIODE_TMR2_US / 8) / 125;
+        if (arriere) {
+            statistiques.microPasArriere += dernierMouvement.microPas;
+        } else {
+            statistiques.microPasAvant += dernierMouvement.microPas;
+        }
+        statistiques.dureeMouvements += dernierMouvement.dureeReelle;
+        if (dernierMouvement.dureeReelle > 0) {
+            vitesse = (uint32_t) dernierMouvement.microPas * 1000
+                    / dernierMouvement.dureeReelle;
+            if (vitesse > statistiques.vitesseMax) {
+                statistiques.vitesseMax = vitesse;
+            }
+        }
+        modifiees = 1;
+    }
+
+    // Freinages et surintensités:
+    n = mouvement.freinages;
+    if (n != freinages) {
+        statistiques.freinages += (unsigned char) (n - freinages);
+        freinages = n;
+        modifiees = 1;
+    }
+    n = mouvement.defauts;
+    if (n != defauts) {
+        statistiques.defauts += (unsigned char) (n - defauts);
+        defauts = n;
+        modifiees = 1;
+        urgentes = 1;
+    }
+
+    // Sauvegarde périodique, moteur à l'arrêt, ou après un défaut:
+    if (modifiees && (urgentes || (!enCours
+            && maintenant - sauvegarde >= PERIODE_SAUVEGARDE))
+            && !eepromOccupee()) {
+        statistiquesSauvegardees = statistiques;
+        eepromCopie(EEPROM_STATISTIQUES,
+                &statistiquesSauvegardees, sizeof(statistiquesSauvegardees));
+        sauvegarde = maintenant;
+        modifiees = 0;
+        urgentes = 0;
+    }
+}
+
+/**
+ * Nombre d'entrées du journal des défauts; doit être une puissance de 2.
+ */
+#define TAILLE_JOURNAL 8
+
+/**
+ * Adresse dans l'EEPROM de l'index de la prochaine entrée du journal,
+ * suivi des entrées.
+ */
+#define EEPROM_JOURNAL_INDEX (EEPROM_STATISTIQUES + sizeof(struct Statistiques))
+#define EEPROM_JOURNAL (EEPROM_JOURNAL_INDEX + 1)
+
+/**
+ * Index de la prochaine entrée du journal.
+ */
+static unsigned char journalIndex;
+
+/**
+ * Entrée du journal en cours d'écriture dans l'EEPROM.
+ */
+static struct EntreeJournal journalEcriture;
+
+/**
+ * Récupère l'index du journal des défauts depuis l'EEPROM.
+ */
+void journalInitialise() {
+    journalIndex = eepromLit(EEPROM_JOURNAL_INDEX);
+    if (journalIndex >= TAILLE_JOURNAL) {
+        journalIndex = 0;
+    }
+}
+
+/**
+ * Copie les défauts en attente dans le journal, puis met à jour
+ * l'index. L'entrée la plus ancienne est écrasée.
+ * À appeler depuis la boucle principale.
+ */
+void journalTache() {
+    static unsigned char indexModifie = 0;
+
+    if (eepromOccupee()) {
+        return;
+    }
+    if (indexModifie) {
+        eepromCopie(EEPROM_JOURNAL_INDEX, &journalIndex, 1);
+        indexModifie = 0;
+        return;
+    }
+    if (defautsSortie != defautsEntree) {
+        journalEcriture = defautsEnAttente[defautsSortie];
+        defautsSortie = (defautsSortie + 1) & (TAILLE_DEFAUTS - 1);
+        eepromCopie(EEPROM_JOURNAL
+                + journalIndex * sizeof(struct EntreeJournal),
+                &journalEcriture, sizeof(journalEcriture));
+        journalIndex = (journalIndex + 1) & (TAILLE_JOURNAL - 1);
+        indexModifie = 1;
+    }
+}
+
+#ifdef CALIBRATION_COURANT
+/**
+ * Calibration du courant, conservée en EEPROM.
+ */
+struct Calibration {
+    /** Version du format; une EEPROM vierge contient 0xFF.*/
+    unsigned char version;
+    /** Correction ajoutée aux rapports cycliques, entre -CALIBRATION_MAX
+     * et CALIBRATION_MAX.*/
+    signed char correction;
+};
+
+/**
+ * Version du format de la calibration.
+ */
+#define VERSION_CALIBRATION 1
+
+/**
+ * Adresse de la calibration dans l'EEPROM, après le journal.
+ */
+#define EEPROM_CALIBRATION \
+    (EEPROM_JOURNAL + TAILLE_JOURNAL * sizeof(struct EntreeJournal))
+
+/**
+ * Périodes du temporisateur 2 (4,752ms) pour que le courant s'établisse
+ * avant chaque mesure.
+ */
+#define CALIBRATION_ATTENTE 4
+
+/**
+ * Conversions par mesure; leur somme doit tenir sur 16 bits.
+ */
+#define CALIBRATION_ECHANTILLONS 64
+
+/**
+ * Écart de rapport cyclique pour mesurer la pente du courant.
+ */
+#define CALIBRATION_ECART 8
+
+/**
+ * Augmentation minimum de la somme des conversions sur
+ * CALIBRATION_ECART: en dessous, le moteur n'est pas alimenté et la
+ * mesure est ignorée.
+ */
+#define CALIBRATION_PENTE_MIN (CALIBRATION_ECHANTILLONS * 8)
+
+/**
+ * Correction maximum, en valeur absolue.
+ */
+#define CALIBRATION_MAX 4
+
+/**
+ * Calibration en service, et sommes des conversions du démarrage.
+ */
+static struct {
+    /** Correction en service, telle qu'elle est conservée.*/
+    struct Calibration sauvegarde;
+    /** 1 si la correction a été mesurée à ce démarrage.*/
+    unsigned char mesuree;
+    /** Pont 1 à 16, pont 1 à 16 + CALIBRATION_ECART, pont 2 à 16.*/
+    uint16_t pont1;
+    uint16_t pont1Ecart;
+    uint16_t pont2;
+} calibration;
+
+/**
+ * Mesure le courant de maintien d'une bobine.
+ * Les conversions se suivent sur plusieurs périodes du PWM, dont elles
+ * parcourent les phases: leur somme suit le courant moyen.
+ * @param pas Le pas de stationnement: 0 alimente le pont de P3A, 8 celui
+ * de P3B.
+ * @param rapport Le rapport cyclique.
+ * @return La somme des CALIBRATION_ECHANTILLONS conversions.
+ */
+uint16_t calibrationMesure(unsigned char pas, unsigned char rapport) {
+    uint16_t somme = 0;
+    unsigned char n;
+
+    commutationStationnement(pas);
+    CCPR3L = rapport;
+#ifdef HACHAGE_MATERIEL
+    // Le comparateur ne doit pas hacher le courant mesuré:
+    VREFCON2 = 31;
+#endif
+
+    // Les interruptions ne sont pas encore actives: le drapeau du
+    // temporisateur 2 compte le temps.
+    for (n = 0; n < CALIBRATION_ATTENTE; n++) {
+        PIR1bits.TMR2IF = 0;
+        while (!PIR1bits.TMR2IF);
+    }
+    PIR1bits.TMR2IF = 0;
+
+    for (n = 0; n < CALIBRATION_ECHANTILLONS; n++) {
+        ADCON0bits.GO = 1;
+        while (ADCON0bits.GO);
+        somme += ADRESH << 8 | ADRESL;
+    }
+    return somme;
+}
+
+/**
+ * Ajoute la correction aux rapports cycliques d'un jeu de tables.
+ * Les pas entiers (0 et 32) restent tels quels: une bobine y est
+ * éteinte, l'autre au maximum.
+ * @param t Le jeu de tables.
+ */
+void calibrationApplique(struct TableCommutation *t) {
+    unsigned char n;
+    signed char rapport;
+
+    for (n = 0; n < 16; n++) {
+        if (t->cos[n] > 0 && t->cos[n] < 32) {
+            rapport = t->cos[n] + calibration.sauvegarde.correction;
+            if (rapport < 1) {
+                rapport = 1;
+            } else if (rapport > 31) {
+                rapport = 31;
+            }
+            t->cos[n] = rapport;
+        }
+    }
+}
+
+/**
+ * Mesure la correction qui équilibre le courant des deux bobines, et la
+ * met en service.
+ * Le courant de chaque bobine suit son rapport cyclique avec la même
+ * pente k, mesurée sur le pont 1. Au rapport 16 + c, le pont 1 reçoit
+ * pont1 + k x c, et le pont 2, alimenté par le complément, pont2 - k x c:
+ * les deux courants sont égaux pour c = (pont2 - pont1) / 2k.
+ * Si le moteur n'est pas alimenté, la correction conservée en EEPROM
+ * reste en service. Une correction nouvelle y est copiée par
+ * eepromTache().
+ * À appeler avant d'activer les interruptions, avec le temporisateur 2
+ * et le ECCP3 configurés.
+ */
+void calibrationInitialise() {
+    signed char correction;
+    unsigned char conservee;
+    int32_t ecart, pente;
+
+    eepromLitBloc(EEPROM_CALIBRATION, &calibration.sauvegarde,
+            sizeof(struct Calibration));
+    conservee = calibration.sauvegarde.version == VERSION_CALIBRATION;
+    if (!conservee) {
+        calibration.sauvegarde.version = VERSION_CALIBRATION;
+        calibration.sauvegarde.correction = 0;
+    }
+
+    // Le convertisseur A/D lit le shunt sur AN9:
+    TRISBbits.RB3 = 1;          // AN9 comme entrée...
+    ANSELBbits.ANSB3 = 1;       // ... analogique.
+    ADCON1bits.PVCFG = 0;       // Référence positive: Vdd.
+    ADCON1bits.NVCFG = 0;       // Référence négative: Vss.
+    ADCON2bits.ADFM = 1;        // Résultat aligné à droite.
+    ADCON2bits.ACQT = 1;        // Acquisition: 2 TAD.
+    ADCON2bits.ADCS = 0;        // TAD: 2 / Fosc, soit 2us.
+    ADCON0bits.CHS = 9;         // Canal AN9.
+    ADCON0bits.ADON = 1;        // Active le convertisseur.
+
+    calibration.pont1 = calibrationMesure(0, 16);
+    calibration.pont1Ecart = calibrationMesure(0, 16 + CALIBRATION_ECART);
+    calibration.pont2 = calibrationMesure(8, 16);
+
+    ADCON0bits.ADON = 0;        // Le convertisseur ne sert plus.
+
+    pente = (int32_t) calibration.pont1Ecart - calibration.pont1;
+    if (pente >= CALIBRATION_PENTE_MIN) {
+        // c = ecart x CALIBRATION_ECART / 2 pente, arrondi:
+        ecart = ((int32_t) calibration.pont2 - calibration.pont1)
+                * CALIBRATION_ECART * 2;
+        if (ecart < 0) {
+            ecart -= 2 * pente;
+        } else {
+            ecart += 2 * pente;
+        }
+        ecart /= 4 * pente;
+        if (ecart > CALIBRATION_MAX) {
+            ecart = CALIBRATION_MAX;
+        } else if (ecart < -CALIBRATION_MAX) {
+            ecart = -CALIBRATION_MAX;
+        }
+        correction = ecart;
+        calibration.mesuree = 1;
+        if (!conservee || correction != calibration.sauvegarde.correction) {
+            calibration.sauvegarde.correction = correction;
+            eepromCopie(EEPROM_CALIBRATION, &calibration.sauvegarde,
+                    sizeof(struct Calibration));
+        }
+    }
+
+    rapportStationnement = 16 + calibration.sauvegarde.correction;
+    calibrationApplique(&tables[0]);
+}
+#endif
+
+/**
+ * Octet qui commence chaque trame.
+ */
+#define SYNCHRONISATION 0xA5
+
+/**
+ * Nombre maximum d'octets de données dans une trame reçue.
+ */
+#define TAILLE_TRAME 32
+
+/**
+ * Nombre maximum d'octets de réponse à une trame.
+ */
+#define TAILLE_REPONSE 128
+
+/**
+ * Nombre de trames que l'hôte peut envoyer sans attendre leur
+ * acquittement. FENETRE trames pleines (TAILLE_TRAME + 4 octets)
+ * tiennent dans le tampon de réception pendant que la boucle principale
+ * envoie une réponse.
+ */
+#define FENETRE 3
+
+/**
+ * Temps maximum entre deux octets d'une même trame, en ms, compté
+ * depuis la réception du dernier (voir serieSilence). Au-delà, la
+ * trame est abandonnée et le décodeur attend la synchronisation.
+ */
+#define DELAI_TRAME 20
+
+/**
+ * Table du CRC-8 (polynôme x^8 + x^2 + x + 1, soit 0x07, valeur
+ * initiale 0), en mémoire programme.
+ * Avec la table, le CRC coûte un OU exclusif et une lecture de la
+ * mémoire programme (TBLRD), soit une douzaine de cycles par octet,
+ * contre une soixantaine pour le calcul bit à bit: make perf-check en
+ * mesure 11 instructions, appel non compris (instructions_crc_octet
+ * dans hote/perf.sh). À 9600 bauds et Fosc = 1MHz, il y a 260 cycles
+ * d'instruction par octet reçu.
+ */
+static const unsigned char tableCrc[256] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+    0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65,
+    0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+    0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5,
+    0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+    0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85,
+    0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+    0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2,
+    0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+    0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2,
+    0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+    0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32,
+    0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+    0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42,
+    0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+    0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C,
+    0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+    0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC,
+    0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+    0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C,
+    0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+    0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C,
+    0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+    0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B,
+    0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+    0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B,
+    0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+    0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB,
+    0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+    0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB,
+    0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3
+};
+
+/**
+ * Ajoute un octet au CRC-8.
+ * @param crc Le CRC des octets précédents.
+ * @param octet L'octet.
+ * @return Le nouveau CRC.
+ */
+unsigned char crc8(unsigned char crc, unsigned char octet) {
+    return tableCrc[crc ^ octet];
+}
+
+/**
+ * Réponse à la dernière trame acceptée: les réponses de chacune de ses
+ * commandes, dans l'ordre. Elle est conservée pour être renvoyée si
+ * l'hôte répète la trame.
+ */
+static unsigned char trameReponse[TAILLE_REPONSE];
+static unsigned char trameReponseLongueur = 0;
+
+/**
+ * Ajoute un octet à la réponse. Si la réponse est pleine, l'octet est
+ * perdu.
+ * @param octet L'octet.
+ */
+void reponseEcrit(unsigned char octet) {
+    if (trameReponseLongueur < TAILLE_REPONSE) {
+        trameReponse[trameReponseLongueur++] = octet;
+    }
+}
+
+/**
+ * Ajoute un entier de 16 bits à la réponse, octet de poids faible en
+ * premier.
+ * @param valeur La valeur.
+ */
+void reponseEcrit16(uint16_t valeur) {
+    reponseEcrit(valeur);
+    reponseEcrit(valeur >> 8);
+}
+
+/**
+ * Ajoute un entier de 32 bits à la réponse, octet de poids faible en
+ * premier.
+ * @param valeur La valeur.
+ */
+void reponseEcrit32(uint32_t valeur) {
+    reponseEcrit16(valeur);
+    reponseEcrit16(valeur >> 16);
+}
+
+/**
+ * Codes des commandes. Une trame peut contenir plusieurs commandes à la
+ * suite; chacune est un code suivi de ses données.
+ * Chaque réponse commence par le code de la commande.
+ */
+/** Le moteur doit avancer.*/
+#define COMMANDE_AVANCE 'A'
+/** Le moteur doit reculer.*/
+#define COMMANDE_RECULE 'R'
+/** Le moteur doit s'arrêter.*/
+#define COMMANDE_ARRETE 'S'
+/** Envoie l'état de la machine (voir Etat), puis la position absolue
+ * en micro-pas (32).*/
+#define COMMANDE_POSITION 'P'
+/** Envoie le journal des défauts, de l'entrée la plus ancienne à la
+ * plus récente: nombre d'entrées, puis pour chaque entrée le temps (32),
+ * le code, l'état, le pas, la position (32) et la commande. Le temps
+ * est celui du défaut. Une entrée jamais écrite a le code 0xFF. Si la
+ * réponse de la trame n'a pas la place pour les TAILLE_JOURNAL
+ * entrées, seules les plus récentes sont envoyées.*/
+#define COMMANDE_JOURNAL 'J'
+/** Envoie les statistiques: micro-pas avant (32), arrière (32), durée
+ * des mouvements (32), mouvements (16), freinages (16), défauts (16),
+ * vitesse maximum (16), puis le bilan du dernier mouvement: micro-pas
+ * (16), durée prévue (32), durée réelle (32).*/
+#define COMMANDE_STATISTIQUES 'T'
+/** Reçoit de nouvelles tables de commutation: les 16 rapports cycliques,
+ * puis les 4 positions des commutateurs. Répond par TABLE_ACCEPTEE,
+ * TABLE_INVALIDE ou TABLE_OCCUPEE.*/
+#define COMMANDE_TABLE 'U'
+
+/** Démarre le mode lecture, si le moteur est à l'arrêt. Suivi de la
+ * période des échantillons, en interruptions du temporisateur 2
+ * (4,752ms); une période de 0 équivaut à COMMANDE_ARRETE. Il vaut
+ * mieux remplir le tampon avant de démarrer. Répond par 1 si le mode
+ * lecture est en cours, 0 sinon.*/
+#define COMMANDE_LECTURE 'L'
+/** Reçoit un bloc de ECHANTILLONS_BLOC échantillons pour le mode
+ * lecture: pour chacun, le rapport cyclique puis la position des
+ * commutateurs. Le bloc est refusé s'il ne tient pas dans le tampon ou
+ * s'il a une valeur hors limites. Pas de réponse.*/
+#define COMMANDE_ECHANTILLONS 'E'
+/** Envoie le bilan du mode lecture: échantillons joués (32), tampons
+ * vides (16), blocs refusés (16), place libre dans le tampon (8).*/
+#define COMMANDE_BILAN_LECTURE 'B'
+
+/**
+ * Nombre d'échantillons par bloc.
+ * À 9600 bauds, la liaison transmet 960 octets par seconde. Un bloc
+ * part dans une trame de 5 + 2 x 8 = 21 octets, donc la liaison
+ * soutient au plus 365 échantillons par seconde. Le temporisateur 2
+ * interrompt 210 fois par seconde: une période de 1 joue 210
+ * échantillons par seconde, 2 en joue 105 et 3 en joue 70. Même la
+ * période de 1 n'occupe que 57% de la liaison. Le bilan permet de le
+ * vérifier (voir hote/scenarios/lecture-debit.txt).
+ */
+#define ECHANTILLONS_BLOC 8
+
+/** Commande le mode suivi. Suivi d'un octet: SUIVI_PREPARE vide la
+ * file et remet le décodeur à zéro, SUIVI_DEMARRE démarre le mouvement
+ * si le moteur est à l'arrêt et que la file contient au moins un pas,
+ * SUIVI_TERMINE indique que la trajectoire est complètement envoyée.
+ * Répond par 1 si le mode suivi est en cours, 0 sinon.*/
+#define COMMANDE_SUIVI 'M'
+/** Reçoit un morceau de trajectoire pour le mode suivi: la longueur
+ * (au plus TAILLE_DONNEES), puis les octets. La trajectoire est une
+ * suite de pas; chaque pas est un entier v codé en varint (7 bits par
+ * octet, poids faible en premier, bit 7 à 1 s'il reste des octets).
+ * Le bit 0 de v est le sens du pas (1 en marche arrière), et les
+ * suivants la différence, en zigzag (0, -1, 1, -2, 2...), entre
+ * l'intervalle qui précède ce pas et celui qui précède le pas
+ * précédent. L'intervalle est en interruptions du temporisateur 2,
+ * entre 1 et 127; celui du premier pas est compté à partir de zéro,
+ * mais le premier pas est fait dès le démarrage.
+ * À vitesse constante, chaque pas occupe donc un seul octet.
+ * Le morceau est refusé si la file n'a pas assez de place pour le
+ * décoder. Répond par 1 si le morceau est accepté, 0 sinon, puis par
+ * la place libre dans la file.*/
+#define COMMANDE_TRAJECTOIRE 'D'
+/** Choisit le mode de décroissance du courant: suivi de
+ * DECROISSANCE_LENTE, DECROISSANCE_RAPIDE, DECROISSANCE_MIXTE ou
+ * DECROISSANCE_AUCUNE, le mode au démarrage. Le mode s'applique dès le
+ * micro-pas suivant; un mode inconnu est ignoré. Répond par le mode en
+ * service.*/
+#define COMMANDE_DECROISSANCE 'C'
+/** Configure le capteur d'index (si CAPTEUR_INDEX est défini): suivi
+ * d'un octet d'options, INDEX_CORRECTION et INDEX_REFERENCE. Répond
+ * par 1 si la référence est établie, puis le nombre d'impulsions (16),
+ * l'écart entre la position et le capteur en micro-pas (16), le total
+ * des corrections (16), et le temps de la dernière impulsion (32).*/
+#define COMMANDE_INDEX 'I'
+/** Envoie la prédiction du freinage, si COMMANDE_ARRETE arrivait
+ * maintenant: l'état de la machine, la position d'arrêt en micro-pas
+ * (32), et la durée du freinage en ms (16). À l'arrêt, en lecture et
+ * en défaut, la position d'arrêt est la position actuelle et la durée
+ * est nulle.*/
+#define COMMANDE_FREINAGE 'F'
+/** Démarre un déplacement profilé, si le moteur est à l'arrêt: suivi
+ * de la distance en micro-pas (16, négative en marche arrière), de
+ * l'intervalle de croisière entre deux pas en interruptions du
+ * temporisateur 2 (1 à 127), et de l'accélération en micro-pas/s²
+ * (16, non nulle). Les pas passent par la file du mode suivi; comme
+ * tout freinage, la fin du déplacement termine le pas entier en cours.
+ * Répond par 1 si le déplacement a démarré, 0 sinon, puis par 1 si
+ * son plan était en mémoire.*/
+#define COMMANDE_PROFIL 'V'
+/** Change la vitesse de croisière et l'accélération du déplacement
+ * profilé en cours, sans l'arrêter: suivi de l'intervalle de croisière
+ * (1 à 127) et de l'accélération en micro-pas/s² (16). Le changement
+ * s'applique après les pas déjà en file, au plus TAILLE_SUIVI - 1.
+ * Répond par 1 si le changement est accepté, 0 sinon (voir
+ * profilChange).*/
+#define COMMANDE_PROFIL_CHANGE 'W'
+/** Envoie l'estimation de l'observateur: la position du rotor en
+ * micro-pas (32), sa vitesse en 1/16 de micro-pas/s (16), et le dernier
+ * résidu entre la mesure et la prédiction en 1/256 de micro-pas (16).
+ * Un résidu qui grandit signale un moteur qui ne suit plus.*/
+#define COMMANDE_OBSERVATEUR 'O'
+/** Envoie la calibration du courant (si CALIBRATION_COURANT est
+ * défini): 1 si la correction a été mesurée à ce démarrage, 0 si elle
+ * vient de l'EEPROM, la correction ajoutée aux rapports cycliques (8,
+ * signée), puis la somme des conversions du pont 1 au rapport 16, du
+ * pont 1 au rapport 16 + CALIBRATION_ECART, et du pont 2 au rapport 16
+ * (16 chacune).*/
+#define COMMANDE_CALIBRATION 'K'
+/** Envoie le trajet appris (si APPRENTISSAGE est défini): 1 s'il est
+ * en train d'être rejoué, le nombre de points, puis la position de
+ * chacun des TAILLE_TRAJET points en micro-pas (32); seuls les premiers
+ * sont valides.*/
+#define COMMANDE_TRAJET 'G'
+/** Règle la sortie «en position» (si SORTIE_EN_POSITION est défini):
+ * suivi du délai entre l'arrêt et la sortie, en interruptions du
+ * temporisateur 2 (4,752ms), pour que le rotor se stabilise: N la met
+ * à 1 à la Nième interruption après celle qui arrête le moteur, 0 dans
+ * celle-ci. Le délai s'applique au prochain arrêt. Répond par le délai,
+ * puis par l'état de la sortie.*/
+#define COMMANDE_EN_POSITION 'N'
+
+/**
+ * Arguments de COMMANDE_SUIVI.
+ */
+#define SUIVI_TERMINE 0
+#define SUIVI_PREPARE 1
+#define SUIVI_DEMARRE 2
+
+/**
+ * Options de COMMANDE_INDEX.
+ */
+/** Corrige la position des pas perdus à chaque arrêt.*/
+#define INDEX_CORRECTION 0x01
+/** Oublie la référence: la prochaine impulsion la remplace.*/
+#define INDEX_REFERENCE 0x02
+
+/**
+ * Indique qu'une commande a des données de longueur variable: la
+ * longueur est alors le premier octet qui suit le code.
+ */
+#define LONGUEUR_VARIABLE 0xFF
+
+/**
+ * Nombre maximum d'octets de données d'une commande.
+ */
+#define TAILLE_DONNEES 20
+
+/**
+ * Réponses à COMMANDE_TABLE.
+ */
+/** Les tables seront en service au prochain pas entier.*/
+#define TABLE_ACCEPTEE 0
+/** Les tables ont une valeur hors limites.*/
+#define TABLE_INVALIDE 1
+/** Les tables précédentes ne sont pas encore en service.*/
+#define TABLE_OCCUPEE 2
+
+/**
+ * Transmet un événement à la machine à états depuis la boucle principale.
+ * La machine à états est aussi appelée par les interruptions de haute
+ * priorité, qui sont suspendues le temps de l'appel.
+ * @param evenement L'événement.
+ */
+void machineDepuisBoucle(enum Evenement evenement) {
+    INTCONbits.GIEH = 0;
+    machine(evenement);
+    INTCONbits.GIEH = 1;
+}
+
+#ifdef CAPTEUR_INDEX
+/**
+ * Micro-pas par tour du moteur: 200 pas entiers de 8 micro-pas.
+ */
+#define MICRO_PAS_PAR_TOUR 1600
+
+/**
+ * Micro-pas par cycle de la séquence de commutation. Un moteur qui
+ * décroche se raccroche au champ un nombre entier de cycles plus loin:
+ * les pas se perdent par 32 micro-pas.
+ */
+#define MICRO_PAS_PAR_CYCLE 32
+
+/**
+ * Bilan du capteur d'index, tenu par la boucle principale.
+ */
+static struct {
+    /** Double du milieu de la première impulsion, modulo le double
+     * d'un tour.*/
+    int16_t reference;
+    /** 1 si la référence est établie.*/
+    unsigned char referenceValide;
+    /** 1 si la position doit être corrigée au prochain arrêt.*/
+    unsigned char correctionAuto;
+    /** Impulsions reçues.*/
+    uint16_t tours;
+    /** Écart entre la position comptée et celle du capteur, en
+     * micro-pas: positif si le moteur est en retard sur la position.*/
+    int16_t derive;
+    /** Total des corrections appliquées, en micro-pas.*/
+    int16_t corrections;
+    /** Millisecondes depuis le démarrage, à la dernière impulsion.*/
+    uint32_t temps;
+} indexBilan;
+
+/**
+ * Compare le milieu de chaque impulsion du capteur d'index avec la
+ * référence, et corrige la position à l'arrêt si c'est demandé.
+ * Seuls les cycles entiers de commutation sont corrigés: un écart plus
+ * petit vient du capteur, et non de pas perdus.
+ * À appeler depuis la boucle principale.
+ */
+void indexTache() {
+    int16_t milieu, ecart, correction;
+
+    if (capteurIndex.pret) {
+        milieu = capteurIndex.milieuDouble % (2 * MICRO_PAS_PAR_TOUR);
+        capteurIndex.pret = 0;
+        indexBilan.temps = tempsEcoule();
+        indexBilan.tours++;
+        if (milieu < 0) {
+            milieu += 2 * MICRO_PAS_PAR_TOUR;
+        }
+        if (!indexBilan.referenceValide) {
+            indexBilan.reference = milieu;
+            indexBilan.referenceValide = 1;
+        }
+        ecart = milieu - indexBilan.reference;
+        if (ecart >= MICRO_PAS_PAR_TOUR) {
+            ecart -= 2 * MICRO_PAS_PAR_TOUR;
+        } else if (ecart < -MICRO_PAS_PAR_TOUR) {
+            ecart += 2 * MICRO_PAS_PAR_TOUR;
+        }
+        indexBilan.derive = ecart / 2;
+    }
+
+    if (!indexBilan.correctionAuto || mouvement.etat != ARRET) {
+        return;
+    }
+    if (indexBilan.derive >= 0) {
+        correction = (indexBilan.derive + MICRO_PAS_PAR_CYCLE / 2)
+                / MICRO_PAS_PAR_CYCLE;
+    } else {
+        correction = -((MICRO_PAS_PAR_CYCLE / 2 - indexBilan.derive)
+                / MICRO_PAS_PAR_CYCLE);
+    }
+    if (correction != 0) {
+        correction *= MICRO_PAS_PAR_CYCLE;
+        capteurIndex.correction = correction;
+        machineDepuisBoucle(CORRIGE);
+        if (capteurIndex.correction == 0) {
+            indexBilan.derive -= correction;
+            indexBilan.corrections += correction;
+        }
+        capteurIndex.correction = 0;
+    }
+}
+
+/**
+ * Configure le capteur d'index, et envoie son bilan.
+ * @param options INDEX_CORRECTION pour corriger la position au prochain
+ * arrêt, INDEX_REFERENCE pour prendre la prochaine impulsion comme
+ * référence.
+ */
+void commandeIndex(unsigned char options) {
+    indexBilan.correctionAuto = (options & INDEX_CORRECTION) != 0;
+    if (options & INDEX_REFERENCE) {
+        indexBilan.referenceValide = 0;
+        indexBilan.derive = 0;
+    }
+    reponseEcrit(COMMANDE_INDEX);
+    reponseEcrit(indexBilan.referenceValide);
+    reponseEcrit16(indexBilan.tours);
+    reponseEcrit16(indexBilan.derive);
+    reponseEcrit16(indexBilan.corrections);
+    reponseEcrit32(indexBilan.temps);
+}
+#endif
+
+/**
+ * Période de l'observateur, en ms.
+ */
+#define PERIODE_OBSERVATEUR 10
+
+/**
+ * Observateur alpha-bêta de la position et de la vitesse du rotor,
+ * tenu par la boucle principale. La mesure est la position commandée,
+ * corrigée des pas perdus relevés par le capteur d'index s'il est
+ * présent. À chaque période:
+ *     prédiction = estimation + vitesse
+ *     résidu = mesure - prédiction
+ *     estimation = prédiction + résidu / 4
+ *     vitesse = vitesse + résidu / 32
+ * Les gains vérifient bêta = alpha² / (2 - alpha), à peu près: le
+ * filtre suit une vitesse constante sans erreur, et lisse les sauts
+ * d'un micro-pas de la mesure. L'estimation est gardée par rapport à
+ * la mesure, pour que la virgule fixe ne déborde pas quelle que soit
+ * la position.
+ */
+static struct {
+    /** Dernière mesure, en micro-pas.*/
+    int32_t mesure;
+    /** Estimation moins la mesure, en 1/256 de micro-pas.*/
+    int32_t ecart;
+    /** Vitesse estimée, en 1/8192 de micro-pas par période: 32 fois
+     * plus fine que la position, pour que le gain bêta soit exact.*/
+    int32_t vitesse;
+    /** Dernier résidu, en 1/256 de micro-pas.*/
+    int32_t residu;
+    /** Millisecondes depuis le démarrage, à la dernière période.*/
+    uint32_t temps;
+} observateur;
+
+/**
+ * Met à jour l'observateur à chaque période écoulée.
+ * Le gain alpha est appliqué par décalage arrondi, et le gain bêta par
+ * l'échelle de la vitesse: arrondi, un petit résidu serait perdu, et la
+ * vitesse resterait décalée à l'arrêt. XC8 comme gcc conservent le
+ * signe des entiers décalés.
+ * Si la boucle principale a pris du retard, rattraper les périodes
+ * manquées une à une les appliquerait toutes à la même mesure, déjà
+ * avancée: la vitesse ferait un saut. Une seule mise à jour couvre
+ * alors tout le retard, la prédiction et le gain bêta étant mis à
+ * l'échelle du nombre de périodes écoulées; au-delà de 255 (2,55s),
+ * le surplus est oublié.
+ * À appeler depuis la boucle principale.
+ */
+void observateurTache() {
+    int32_t mesure, residu;
+    uint32_t ecoule;
+    unsigned char periodes;
+
+    ecoule = tempsEcoule() - observateur.temps;
+    if (ecoule < PERIODE_OBSERVATEUR) {
+        return;
+    }
+    periodes = 1;
+    if (ecoule >= 2 * PERIODE_OBSERVATEUR) {
+        if (ecoule > 255 * PERIODE_OBSERVATEUR) {
+            observateur.temps += ecoule - 255 * PERIODE_OBSERVATEUR;
+            ecoule = 255 * PERIODE_OBSERVATEUR;
+        }
+        periodes = ecoule / PERIODE_OBSERVATEUR;
+    }
+    observateur.temps += PERIODE_OBSERVATEUR * periodes;
+
+    INTCONbits.GIEH = 0;
+    mesure = mouvement.position;
+    INTCONbits.GIEH = 1;
+#ifdef CAPTEUR_INDEX
+    mesure -= indexBilan.derive;
+#endif
+
+    residu = (mesure - observateur.mesure) * 256 - observateur.ecart
+            - ((observateur.vitesse * periodes + 16) >> 5);
+    observateur.mesure = mesure;
+    observateur.residu = residu;
+    observateur.ecart = -residu + ((residu + 2) >> 2);
+    if (periodes > 1) {
+        residu /= periodes;
+    }
+    observateur.vitesse += residu;
+}
+
+/**
+ * Envoie le journal des défauts.
+ */
+void commandeJournal() {
+    struct EntreeJournal entree;
+    unsigned char n, i, libre;
+
+    // Les entrées qui ne tiennent plus dans la réponse sont omises:
+    libre = TAILLE_REPONSE - trameReponseLongueur;
+    n = 0;
+    if (libre > 2) {
+        n = (libre - 2) / sizeof(struct EntreeJournal);
+    }
+    if (n > TAILLE_JOURNAL) {
+        n = TAILLE_JOURNAL;
+    }
+
+    reponseEcrit(COMMANDE_JOURNAL);
+    reponseEcrit(n);
+    for (n = TAILLE_JOURNAL - n; n < TAILLE_JOURNAL; n++) {
+        i = (journalIndex + n) & (TAILLE_JOURNAL - 1);
+        eepromLitBloc(EEPROM_JOURNAL + i * sizeof(struct EntreeJournal),
+                &entree, sizeof(entree));
+        reponseEcrit32(entree.temps);
+        reponseEcrit(entree.code);
+        reponseEcrit(entree.etat);
+        reponseEcrit(entree.pas);
+        reponseEcrit32(entree.position);
+        reponseEcrit(entree.commande);
+    }
+}
+
+/**
+ * Envoie l'estimation de l'observateur.
+ */
+void commandeObservateur() {
+    int32_t residu = observateur.residu;
+
+    if (residu > 32767) {
+        residu = 32767;
+    } else if (residu < -32767) {
+        residu = -32767;
+    }
+    reponseEcrit(COMMANDE_OBSERVATEUR);
+    reponseEcrit32(observateur.mesure + ((observateur.ecart + 128) >> 8));
+    reponseEcrit16((observateur.vitesse * (16 * 1000 / PERIODE_OBSERVATEUR))
+            >> 13);
+    reponseEcrit16(residu);
+}
+
+#ifdef CALIBRATION_COURANT
+/**
+ * Envoie la calibration du courant.
+ */
+void commandeCalibration() {
+    reponseEcrit(COMMANDE_CALIBRATION);
+    reponseEcrit(calibration.mesuree);
+    reponseEcrit(calibration.sauvegarde.correction);
+    reponseEcrit16(calibration.pont1);
+    reponseEcrit16(calibration.pont1Ecart);
+    reponseEcrit16(calibration.pont2);
+}
+#endif
+
+/**
+ * Envoie l'état de la machine et la position absolue.
+ * La machine à états est suspendue pendant la copie.
+ */
+void commandePosition() {
+    unsigned char etat;
+    int32_t position;
+
+    INTCONbits.GIEH = 0;
+    etat = mouvement.etat;
+    position = mouvement.position;
+    INTCONbits.GIEH = 1;
+
+    reponseEcrit(COMMANDE_POSITION);
+    reponseEcrit(etat);
+    reponseEcrit32(position);
+}
+
+/**
+ * Envoie la prédiction du freinage, si l'ordre de s'arrêter arrivait
+ * maintenant: l'état de la machine, la position d'arrêt et la durée.
+ * La machine à états est suspendue pendant la copie.
+ */
+void commandeFreinage() {
+    unsigned char etat;
+    unsigned char sens;
+    unsigned char diviseur;
+    int32_t position;
+    signed char distance;
+    uint16_t duree = 0;
+
+    INTCONbits.GIEH = 0;
+    etat = mouvement.etat;
+    sens = suivi.sens;
+    diviseur = diviseurTictac;
+    position = mouvement.position;
+    INTCONbits.GIEH = 1;
+
+    distance = freinageDistance(etat, sens, (unsigned char) position);
+    switch (etat) {
+        case MARCHE_AVANT:
+        case FREIN_AVANT:
+        case MARCHE_ARRIERE:
+        case FREIN_ARRIERE:
+        case SUIVI:
+            duree = (uint32_t) freinageDuree(distance, diviseur)
+                    * PERIODE_TMR2_US / 1000;
+            break;
+    }
+
+    reponseEcrit(COMMANDE_FREINAGE);
+    reponseEcrit(etat);
+    reponseEcrit32(position + distance);
+    reponseEcrit16(duree);
+}
+
+/**
+ * Envoie les statistiques.
+ */
+void commandeStatistiques() {
+    reponseEcrit(COMMANDE_STATISTIQUES);
+    reponseEcrit32(statistiques.microPasAvant);
+    reponseEcrit32(statistiques.microPasArriere);
+    reponseEcrit32(statistiques.dureeMouvements);
+    reponseEcrit16(statistiques.mouvements);
+    reponseEcrit16(statistiques.freinages);
+    reponseEcrit16(statistiques.defauts);
+    reponseEcrit16(statistiques.vitesseMax);
+    reponseEcrit16(dernierMouvement.microPas);
+    reponseEcrit32(dernierMouvement.dureePrevue);
+    reponseEcrit32(dernierMouvement.dureeReelle);
+}
+
+/**
+ * Vérifie qu'une position des commutateurs ferme exactement un
+ * commutateur de chaque pont: RA0 ou RA1 pour le premier, RA2 ou RA3
+ * pour le second.
+ * @param commutateurs La position des commutateurs.
+ * @return 1 si la position est valide.
+ */
+unsigned char tableCommutateursValide(unsigned char commutateurs) {
+    unsigned char pont1 = commutateurs & 0x03;
+    unsigned char pont2 = commutateurs & 0x0C;
+
+    if (commutateurs & 0xF0) {
+        return 0;
+    }
+    return (pont1 == 0x01 || pont1 == 0x02)
+        && (pont2 == 0x04 || pont2 == 0x08);
+}
+
+/**
+ * Vérifie les tables reçues, et les prépare dans la réserve pour
+ * qu'elles soient mises en service au prochain pas entier.
+ * @param donnees Les 16 rapports cycliques, puis les 4 positions des
+ * commutateurs.
+ */
+void commandeTable(unsigned char *donnees) {
+    struct TableCommutation *reserve;
+    unsigned char n, reponse = TABLE_ACCEPTEE;
+
+    for (n = 0; n < 16; n++) {
+        if (donnees[n] > PR2 + 1) {
+            reponse = TABLE_INVALIDE;
+        }
+    }
+    for (n = 0; n < 4; n++) {
+        if (!tableCommutateursValide(donnees[16 + n])) {
+            reponse = TABLE_INVALIDE;
+        }
+    }
+    if (tableEchange) {
+        reponse = TABLE_OCCUPEE;
+    }
+
+    if (reponse == TABLE_ACCEPTEE) {
+        reserve = tableReserve();
+        for (n = 0; n < 16; n++) {
+            reserve->cos[n] = donnees[n];
+#ifdef HACHAGE_MATERIEL
+            if (donnees[n] > 16) {
+                reserve->consigneCourant[n] = donnees[n];
+            } else {
+                reserve->consigneCourant[n] = 32 - donnees[n];
+            }
+            if (reserve->consigneCourant[n] > 31) {
+                reserve->consigneCourant[n] = 31;
+            }
+#endif
+        }
+        for (n = 0; n < 4; n++) {
+            reserve->commutateurs[n] = donnees[16 + n];
+        }
+#ifdef CALIBRATION_COURANT
+        calibrationApplique(reserve);
+#endif
+#ifdef COMMUTATION_RAPIDE
+        tablePrepare(reserve);
+#endif
+        tableEchange = 1;
+    }
+
+    reponseEcrit(COMMANDE_TABLE);
+    reponseEcrit(reponse);
+}
+
+/**
+ * Nombre de blocs d'échantillons refusés.
+ */
+static uint16_t lectureRefus = 0;
+
+/**
+ * Démarre ou arrête le mode lecture.
+ * @param periode Période des échantillons, en interruptions du
+ * temporisateur 2, ou 0 pour arrêter.
+ */
+void commandeLecture(unsigned char periode) {
+    if (periode > 0) {
+        periodeLecture = periode;
+        lectureRefus = 0;
+        machineDepuisBoucle(LIS);
+    } else {
+        machineDepuisBoucle(ARRETE);
+    }
+    reponseEcrit(COMMANDE_LECTURE);
+    reponseEcrit(lectureBilan.active);
+}
+
+/**
+ * Ajoute un bloc d'échantillons au tampon du mode lecture.
+ * @param donnees Les échantillons: rapport cyclique, puis position des
+ * commutateurs.
+ */
+void commandeEchantillons(unsigned char *donnees) {
+    unsigned char n, libre, entree;
+
+    libre = (lectureSortie - lectureEntree - 1) & (TAILLE_LECTURE - 1);
+    if (libre < ECHANTILLONS_BLOC) {
+        lectureRefus++;
+        return;
+    }
+    for (n = 0; n < 2 * ECHANTILLONS_BLOC; n += 2) {
+        if (donnees[n] > PR2 + 1
+                || !tableCommutateursValide(donnees[n + 1])) {
+            lectureRefus++;
+            return;
+        }
+    }
+    entree = lectureEntree;
+    for (n = 0; n < 2 * ECHANTILLONS_BLOC; n += 2) {
+        lectureRapports[entree] = donnees[n];
+        lectureCommutateurs[entree] = donnees[n + 1];
+        entree = (entree + 1) & (TAILLE_LECTURE - 1);
+    }
+    lectureEntree = entree;
+}
+
+/**
+ * Envoie le bilan du mode lecture.
+ */
+void commandeBilanLecture() {
+    uint32_t joues;
+    uint16_t sousAlimentations;
+
+    INTCONbits.GIEH = 0;
+    joues = lectureBilan.joues;
+    sousAlimentations = lectureBilan.sousAlimentations;
+    INTCONbits.GIEH = 1;
+
+    reponseEcrit(COMMANDE_BILAN_LECTURE);
+    reponseEcrit32(joues);
+    reponseEcrit16(sousAlimentations);
+    reponseEcrit16(lectureRefus);
+    reponseEcrit((lectureSortie - lectureEntree - 1) & (TAILLE_LECTURE - 1));
+}
+
+/**
+ * État du décodeur de trajectoire.
+ */
+static struct {
+    /** Entier en cours de décodage.*/
+    uint16_t valeur;
+    /** Position du prochain groupe de 7 bits.*/
+    unsigned char decalage;
+    /** Intervalle précédant le dernier pas décodé.*/
+    unsigned char intervalle;
+} decodeur;
+
+/**
+ * Nombre de pas refusés par le décodeur de trajectoire.
+ */
+static uint16_t suiviRefus = 0;
+
+/**
+ * Pas d'un déplacement profilé en cours de génération: la boucle
+ * principale les ajoute à la file du mode suivi à mesure qu'elle se
+ * vide (voir profilTache).
+ * L'intervalle entre deux pas suit une rampe: c[j] est l'intervalle
+ * qui suit le pas j de la rampe, avec
+ *     c[j] = c[j - 1] - 2 c[j - 1] / (4j + 1)
+ * et c[0] = 0,676 x sqrt(2 / accélération). La division est arrondie:
+ * tronquée, elle ralentirait la rampe de 10% après quelques milliers
+ * de pas, et c[j] s'écarterait de la rampe idéale (voir rampeRang).
+ * La rampe monte sur les premiers pas jusqu'à la croisière, et
+ * redescend sur les derniers (voir profilIntervalle).
+ */
+static struct {
+    /** 1 pendant la génération.*/
+    unsigned char actif;
+    /** Sens du déplacement: 1 en marche arrière.*/
+    unsigned char sens;
+    /** Intervalle de croisière, en interruptions du temporisateur 2.*/
+    unsigned char croisiere;
+    /** Nombre de pas du déplacement.*/
+    uint16_t pas;
+    /** Prochain pas à mettre en file.*/
+    uint16_t suivant;
+    /** Rang de la croisière dans la rampe (voir profilPlanifie).*/
+    uint16_t rampe;
+    /** Rang j dans la rampe de l'intervalle c.*/
+    uint16_t j;
+    /** Intervalle c[j], en 1/65536 d'interruption: à 1/256, la
+     * différence entre deux intervalles s'annule avant la croisière
+     * quand l'accélération est faible.*/
+    uint32_t c;
+} profil;
+
+/**
+ * Rend la place libre dans la file du mode suivi.
+ * @return Le nombre d'entrées libres.
+ */
+unsigned char suiviLibre() {
+    return (suiviSortie - suiviEntree - 1) & (TAILLE_SUIVI - 1);
+}
+
+/**
+ * Décode un octet de trajectoire, et ajoute le pas à la file s'il est
+ * complet. Un pas dont l'intervalle sort des limites est refusé.
+ * Il faut vérifier avant qu'il y a de la place dans la file.
+ * @param octet L'octet.
+ */
+void suiviDecode(unsigned char octet) {
+    uint16_t zigzag;
+    int16_t intervalle;
+
+    decodeur.valeur |= (uint16_t) (octet & 0x7F) << decodeur.decalage;
+    if (octet & 0x80) {
+        decodeur.decalage += 7;
+        if (decodeur.decalage > 14) {
+            decodeur.valeur = 0;
+            decodeur.decalage = 0;
+            suiviRefus++;
+        }
+        return;
+    }
+
+    zigzag = decodeur.valeur >> 1;
+    intervalle = decodeur.intervalle;
+    if (zigzag & 1) {
+        intervalle -= (zigzag >> 1) + 1;
+    } else {
+        intervalle += zigzag >> 1;
+    }
+    if (intervalle < 1 || intervalle > 127) {
+        suiviRefus++;
+    } else {
+        decodeur.intervalle = intervalle;
+        fileSuivi[suiviEntree] = (decodeur.valeur & 1) << 7 | intervalle;
+        suiviEntree = (suiviEntree + 1) & (TAILLE_SUIVI - 1);
+    }
+    decodeur.valeur = 0;
+    decodeur.decalage = 0;
+}
+
+/**
+ * Commande le mode suivi.
+ * @param argument SUIVI_PREPARE, SUIVI_DEMARRE ou SUIVI_TERMINE.
+ */
+void commandeSuivi(unsigned char argument) {
+    switch(argument) {
+        case SUIVI_PREPARE:
+            if (!suivi.actif) {
+                suiviSortie = suiviEntree;
+                decodeur.valeur = 0;
+                decodeur.decalage = 0;
+                decodeur.intervalle = 0;
+                suiviRefus = 0;
+                suivi.fin = 0;
+            }
+            break;
+        case SUIVI_DEMARRE:
+            machineDepuisBoucle(SUIS);
+            break;
+        case SUIVI_TERMINE:
+            suivi.fin = 1;
+            break;
+    }
+    reponseEcrit(COMMANDE_SUIVI);
+    reponseEcrit(suivi.actif);
+}
+
+/**
+ * Décode un morceau de trajectoire dans la file du mode suivi.
+ * Chaque octet produit au plus un pas; le morceau est refusé si la
+ * file n'a pas autant de places libres que d'octets.
+ * @param donnees Les octets de la trajectoire.
+ * @param longueur Le nombre d'octets.
+ */
+void commandeTrajectoire(unsigned char *donnees, unsigned char longueur) {
+    unsigned char n, accepte = 0;
+
+    if (!profil.actif && suiviLibre() >= longueur) {
+        for (n = 0; n < longueur; n++) {
+            suiviDecode(donnees[n]);
+        }
+        accepte = 1;
+    }
+    reponseEcrit(COMMANDE_TRAJECTOIRE);
+    reponseEcrit(accepte);
+    reponseEcrit(suiviLibre());
+}
+
+/**
+ * Nombre de plans de déplacement gardés en mémoire.
+ */
+#define TAILLE_PLANS 4
+
+/**
+ * Intervalle c[0] de la rampe pour une accélération de 1 micro-pas/s²,
+ * en 1/256 d'interruption: 0,676 x sqrt(2) x 256 / PERIODE_TMR2_US.
+ * Il est divisé par la racine de l'accélération.
+ */
+#define RAMPE_C0_UNITAIRE ((uint32_t) 676 * 1414 * 256 / PERIODE_TMR2_US)
+
+/**
+ * Plans des derniers déplacements profilés. Les machines répètent
+ * souvent les mêmes déplacements: le plan, dont le calcul coûte une
+ * racine carrée et quelques divisions, est alors repris tel quel. Le
+ * plan le moins récemment utilisé est remplacé.
+ */
+static struct {
+    /** Distance, vitesse et accélération demandées. Une accélération
+     * nulle marque une entrée vide.*/
+    int16_t distance;
+    unsigned char croisiere;
+    uint16_t acceleration;
+    /** Intervalle c[0], en 1/256 d'interruption.*/
+    uint16_t c0;
+    /** Pas de la rampe d'accélération.*/
+    uint16_t rampe;
+    /** Valeur de plansHorloge à la dernière utilisation.*/
+    uint16_t utilisation;
+} plans[TAILLE_PLANS];
+
+/**
+ * Compte les utilisations de plans, pour trouver le moins récent.
+ */
+static uint16_t plansHorloge = 0;
+
+/**
+ * Rend la racine carrée entière d'un entier de 32 bits.
+ * @param valeur L'entier.
+ * @return La racine, arrondie par défaut.
+ */
+uint16_t racineCarree(uint32_t valeur) {
+    uint32_t bit = (uint32_t) 1 << 30;
+    uint32_t racine = 0;
+
+    while (bit > valeur) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (valeur >= racine + bit) {
+            valeur -= racine + bit;
+            racine = (racine >> 1) + bit;
+        } else {
+            racine >>= 1;
+        }
+        bit >>= 2;
+    }
+    return racine;
+}
+
+/**
+ * Rend l'intervalle c[0] de la rampe. Les intervalles au-delà de 127
+ * interruptions sont ramenés à 127.
+ * @param acceleration L'accélération, en micro-pas/s², non nulle.
+ * @return L'intervalle, en 1/256 d'interruption.
+ */
+uint16_t rampeC0(uint16_t acceleration) {
+    uint16_t c0;
+
+    c0 = racineCarree(RAMPE_C0_UNITAIRE * RAMPE_C0_UNITAIRE
+            / acceleration);
+    if (c0 > 127 * 256) {
+        c0 = 127 * 256;
+    }
+    return c0;
+}
+
+/**
+ * Rend le rang d'un intervalle dans une rampe: le nombre de pas qu'elle
+ * met à l'atteindre depuis l'arrêt. La rampe idéale, dont c[j] suit la
+ * récurrence à quelques pour mille près, a
+ *     c[n] = c'[0] x (sqrt(n + 1) - sqrt(n)), avec c'[0] = c[0] / 0,676
+ * d'où, pour q = c'[0] / c, n = ((q - 1 / q) / 2)². Le calcul, en
+ * virgule fixe sur 8 bits, ne coûte que deux divisions quel que soit
+ * le rang.
+ * @param c0 L'intervalle c[0], en 1/256 d'interruption (voir rampeC0).
+ * @param c L'intervalle, en 1/65536 d'interruption, au moins 1
+ * interruption.
+ * @return Le rang, arrondi par excès.
+ */
+uint16_t rampeRang(uint16_t c0, uint32_t c) {
+    uint32_t q, d;
+
+    // q en 1/256; 379 / 256 vaut 1 / 0,676:
+    q = (uint32_t) c0 * 379 * 256 / c;
+    if (q <= 256) {
+        return 0;
+    }
+    d = (q - 65536 / q) / 2;
+    d = (d * d + 65535) >> 16;
+    if (d > 0xFFFF) {
+        return 0xFFFF;
+    }
+    return d;
+}
+
+/**
+ * Planifie un déplacement profilé: l'intervalle c[0] du premier pas de
+ * rampe, et le nombre de pas de la rampe jusqu'à la croisière, limité à
+ * la moitié du déplacement. Les deux coûtent quelques divisions, quelle
+ * que soit la longueur de la rampe (voir rampeRang). Le plan est
+ * repris des plans récents s'il y est, sinon il est calculé et remplace
+ * le moins récent.
+ * @param distance La distance, en micro-pas.
+ * @param croisiere L'intervalle de croisière, entre 1 et 127.
+ * @param acceleration L'accélération, en micro-pas/s², non nulle.
+ * @return 1 si le plan était en mémoire.
+ */
+unsigned char profilPlanifie(int16_t distance, unsigned char croisiere,
+        uint16_t acceleration) {
+    unsigned char n, choix = 0;
+    uint16_t moitie, j, c0;
+
+    plansHorloge++;
+    for (n = 0; n < TAILLE_PLANS; n++) {
+        if (plans[n].acceleration == acceleration
+                && plans[n].distance == distance
+                && plans[n].croisiere == croisiere) {
+            plans[n].utilisation = plansHorloge;
+            profil.c = (uint32_t) plans[n].c0 << 8;
+            profil.rampe = plans[n].rampe;
+            return 1;
+        }
+        if (plans[choix].acceleration != 0
+                && (plans[n].acceleration == 0
+                    || plansHorloge - plans[n].utilisation
+                        > plansHorloge - plans[choix].utilisation)) {
+            choix = n;
+        }
+    }
+
+    // Rang de l'intervalle de croisière dans la rampe, sans la suivre
+    // pas à pas. Plus lente que c[0], la croisière commence dès le
+    // premier pas:
+    c0 = rampeC0(acceleration);
+    j = 0;
+    if ((uint32_t) croisiere << 8 < c0) {
+        j = rampeRang(c0, (uint32_t) croisiere << 16);
+    }
+    moitie = profil.pas / 2;
+    if (j > moitie) {
+        j = moitie;
+    }
+
+    plans[choix].distance = distance;
+    plans[choix].croisiere = croisiere;
+    plans[choix].acceleration = acceleration;
+    plans[choix].c0 = c0;
+    plans[choix].rampe = j;
+    plans[choix].utilisation = plansHorloge;
+    profil.c = (uint32_t) c0 << 8;
+    profil.rampe = j;
+    return 0;
+}
+
+/**
+ * Rend l'intervalle qui précède le prochain pas du déplacement profilé,
+ * et avance dans la rampe. À chaque pas, le rang j dans la rampe monte
+ * ou descend d'un cran vers le rang de la croisière, puis est limité
+ * au nombre de pas restants, pour que la rampe redescende jusqu'à c[0]
+ * au dernier pas. Au rang de la croisière, l'intervalle est celui de la
+ * croisière.
+ * @return L'intervalle, entre 1 et 127.
+ */
+unsigned char profilIntervalle() {
+    uint16_t j = profil.j, k = profil.suivant;
+    uint16_t intervalle;
+
+    // Le premier intervalle ne compte pas, et le second est c[0]:
+    if (k >= 2) {
+        if (j < profil.rampe) {
+            j++;
+        } else if (j > profil.rampe) {
+            j--;
+        }
+        if (j > profil.pas - 1 - k) {
+            j = profil.pas - 1 - k;
+        }
+        if (j > profil.j) {
+            profil.c -= (2 * profil.c + 2 * j) / (4 * j + 1);
+        } else if (j < profil.j) {
+            profil.c += (2 * profil.c + 2 * profil.j - 1)
+                    / (4 * profil.j - 1);
+        }
+        profil.j = j;
+    }
+    if (j == profil.rampe) {
+        return profil.croisiere;
+    }
+
+    // Le rang de la croisière (voir rampeRang) peut dépasser d'un pas
+    // celui où la rampe l'atteint; elle ne va pas plus vite:
+    intervalle = (profil.c + 32768) >> 16;
+    if (j < profil.rampe && intervalle < profil.croisiere) {
+        return profil.croisiere;
+    }
+    if (intervalle < 1) {
+        return 1;
+    }
+    if (intervalle > 127) {
+        return 127;
+    }
+    return intervalle;
+}
+
+/**
+ * Change la vitesse de croisière et l'accélération du déplacement
+ * profilé en cours. La rampe est recalculée depuis la vitesse du
+ * dernier pas mis en file: son rang dans la nouvelle rampe, et le rang
+ * de la nouvelle croisière (voir rampeRang). Le moteur y monte ou y
+ * descend sans s'arrêter, dès les pas qui suivent ceux déjà en file.
+ * @param croisiere Le nouvel intervalle de croisière, entre 1 et 127.
+ * @param acceleration La nouvelle accélération, en micro-pas/s².
+ * @return 1 si le changement est accepté, 0 s'il n'y a plus de pas à
+ * générer, ou si la nouvelle accélération ne suffit pas à freiner sur
+ * les pas restants.
+ */
+unsigned char profilChange(unsigned char croisiere,
+        uint16_t acceleration) {
+    uint32_t actuel;
+    uint16_t c0, rang, rampe, reste;
+
+    if (!profil.actif || croisiere < 1 || croisiere > 127
+            || acceleration == 0) {
+        return 0;
+    }
+    reste = profil.pas - 1 - profil.suivant;
+    actuel = profil.c;
+    if (profil.j == profil.rampe) {
+        actuel = (uint32_t) profil.croisiere << 16;
+    }
+
+    // Plus lent que c[0], le moteur reprend la rampe à son début:
+    c0 = rampeC0(acceleration);
+    rang = rampeRang(c0, actuel);
+    if (rang == 0) {
+        actuel = (uint32_t) c0 << 8;
+    }
+    if (rang > reste) {
+        return 0;
+    }
+    rampe = rampeRang(c0, (uint32_t) croisiere << 16);
+    if (rampe > profil.pas) {
+        rampe = profil.pas;
+    }
+
+    profil.croisiere = croisiere;
+    profil.rampe = rampe;
+    profil.j = rang;
+    profil.c = actuel;
+    return 1;
+}
+
+/**
+ * Pas du déplacement profilé mis en file à chaque appel de
+ * profilTache(): chacun coûte une division de 32 bits. À la vitesse
+ * maximum, la file ne perd qu'un pas par interruption du
+ * temporisateur 2, et la boucle principale tourne bien plus souvent.
+ */
+#define PROFIL_PAS_TACHE 4
+
+/**
+ * Met les pas du déplacement profilé dans la file du mode suivi, tant
+ * qu'elle a de la place, au plus PROFIL_PAS_TACHE à la fois: à la
+ * vitesse maximum, ses 31 pas laissent 147ms à la boucle principale
+ * pour revenir la remplir. Abandonne le déplacement si le moteur s'est
+ * arrêté avant la fin.
+ */
+void profilTache() {
+    unsigned char n = 0;
+
+    if (!profil.actif) {
+        return;
+    }
+    if (profil.suivant > 0 && !suivi.actif) {
+        profil.actif = 0;
+        return;
+    }
+    while (profil.suivant < profil.pas && suiviLibre() > 0
+            && n++ < PROFIL_PAS_TACHE) {
+        fileSuivi[suiviEntree] = profil.sens << 7 | profilIntervalle();
+        suiviEntree = (suiviEntree + 1) & (TAILLE_SUIVI - 1);
+        profil.suivant++;
+    }
+    if (profil.suivant == profil.pas) {
+        suivi.fin = 1;
+        profil.actif = 0;
+    }
+}
+
+/**
+ * Démarre un déplacement profilé, si le moteur est à l'arrêt.
+ * @param distance La distance en micro-pas, négative en marche arrière.
+ * @param croisiere L'intervalle de croisière, en interruptions du
+ * temporisateur 2 (1 à 127).
+ * @param acceleration L'accélération en micro-pas/s², non nulle.
+ * @param connu Reçoit 1 si le plan du déplacement était en mémoire.
+ * @return 1 si le déplacement a démarré.
+ */
+unsigned char profilDemarre(int16_t distance, unsigned char croisiere,
+        uint16_t acceleration, unsigned char *connu) {
+    unsigned char accepte = 0;
+
+    *connu = 0;
+    if (distance != 0 && croisiere >= 1 && croisiere <= 127
+            && acceleration != 0 && mouvement.etat == ARRET
+            && !suivi.actif && !profil.actif) {
+        suiviSortie = suiviEntree;
+        decodeur.valeur = 0;
+        decodeur.decalage = 0;
+        decodeur.intervalle = 0;
+        suivi.fin = 0;
+
+        profil.sens = distance < 0;
+        profil.pas = distance < 0 ? 0 - (uint16_t) distance : distance;
+        profil.croisiere = croisiere;
+        profil.suivant = 0;
+        profil.j = 0;
+        *connu = profilPlanifie(distance, croisiere, acceleration);
+        profil.actif = 1;
+        profilTache();
+        machineDepuisBoucle(SUIS);
+        accepte = suivi.actif;
+        if (!accepte) {
+            profil.actif = 0;
+        }
+    }
+    return accepte;
+}
+
+/**
+ * Démarre un déplacement profilé, si le moteur est à l'arrêt.
+ * @param donnees La distance en micro-pas (16, négative en marche
+ * arrière), l'intervalle de croisière, et l'accélération en
+ * micro-pas/s² (16).
+ */
+void commandeProfil(unsigned char *donnees) {
+    unsigned char accepte, connu;
+
+    accepte = profilDemarre((signed char) donnees[1] * 256 + donnees[0],
+            donnees[2], donnees[3] | donnees[4] << 8, &connu);
+    reponseEcrit(COMMANDE_PROFIL);
+    reponseEcrit(accepte);
+    reponseEcrit(connu);
+}
+
+/**
+ * Change le profil du déplacement profilé en cours.
+ * @param donnees L'intervalle de croisière, puis l'accélération en
+ * micro-pas/s² (16).
+ */
+void commandeProfilChange(unsigned char *donnees) {
+    reponseEcrit(COMMANDE_PROFIL_CHANGE);
+    reponseEcrit(profilChange(donnees[0], donnees[1] | donnees[2] << 8));
+}
+
+#ifdef APPRENTISSAGE
+/**
+ * Nombre maximum de points de passage du trajet appris.
+ */
+#define TAILLE_TRAJET 16
+
+/**
+ * Trajet appris, conservé en EEPROM.
+ * Les champs de 32 bits viennent en premier, pour que la structure
+ * n'ait pas de trous.
+ */
+struct Trajet {
+    /** Position absolue de chaque point de passage, en micro-pas.*/
+    int32_t points[TAILLE_TRAJET];
+    /** Nombre de points; une EEPROM vierge contient 0xFF.*/
+    unsigned char nombre;
+};
+
+/**
+ * Adresse du trajet dans l'EEPROM (256 octets): à la fin, loin des
+ * blocs qui la remplissent depuis le début.
+ */
+#define EEPROM_TRAJET (256 - sizeof(struct Trajet))
+
+/**
+ * Boutons de l'apprentissage, actifs à 0, avec une résistance de
+ * tirage externe (le port C n'en a pas).
+ */
+#define BOUTON_MEMORISE 0x01
+#define BOUTON_REJOUE 0x02
+
+/**
+ * Période de relevé des boutons, en ms: plus longue que leurs rebonds.
+ */
+#define PERIODE_BOUTONS 20
+
+/**
+ * Durée d'appui sur BOUTON_MEMORISE qui efface le trajet, en ms.
+ */
+#define DUREE_EFFACEMENT 2000
+
+/**
+ * Accélération des déplacements du trajet rejoué, en micro-pas/s².
+ * Leur croisière est la vitesse maximum: un pas par interruption.
+ */
+#define APPRENTISSAGE_ACCELERATION 2000
+
+/**
+ * Plus grand déplacement profilé du trajet rejoué: un nombre entier de
+ * pas qui tient sur 16 bits. Un point plus éloigné est atteint en
+ * plusieurs déplacements.
+ */
+#define APPRENTISSAGE_DISTANCE_MAX 32760
+
+/**
+ * Trajet appris.
+ */
+static struct Trajet trajet;
+
+/**
+ * État de l'apprentissage.
+ */
+static struct {
+    /** 1 pendant que le trajet est rejoué.*/
+    unsigned char lecture;
+    /** Prochain point de passage.*/
+    unsigned char point;
+    /** 1 si un déplacement du trajet est en cours.*/
+    unsigned char deplacement;
+    /** Position attendue à la fin de ce déplacement.*/
+    int32_t arrivee;
+    /** 1 si le trajet doit être copié dans l'EEPROM.*/
+    unsigned char modifie;
+    /** Boutons enfoncés au dernier relevé.*/
+    unsigned char boutons;
+    /** Temps du dernier relevé, et de l'appui sur BOUTON_MEMORISE.*/
+    uint32_t releve;
+    uint32_t appui;
+} apprentissage;
+
+/**
+ * Récupère le trajet appris depuis l'EEPROM.
+ */
+void apprentissageInitialise() {
+    eepromLitBloc(EEPROM_TRAJET, &trajet, sizeof(struct Trajet));
+    if (trajet.nombre > TAILLE_TRAJET) {
+        trajet.nombre = 0;
+    }
+}
+
+/**
+ * Rend la position absolue.
+ * La machine à états est suspendue pendant la copie.
+ * @return La position, en micro-pas.
+ */
+int32_t apprentissagePosition() {
+    int32_t position;
+
+    INTCONbits.GIEH = 0;
+    position = mouvement.position;
+    INTCONbits.GIEH = 1;
+    return position;
+}
+
+/**
+ * Ajoute la position en cours au trajet, si le moteur est à l'arrêt.
+ * La même position n'est pas ajoutée deux fois de suite.
+ */
+void apprentissageMemorise() {
+    int32_t position;
+
+    if (apprentissage.lecture || mouvement.etat != ARRET
+            || trajet.nombre >= TAILLE_TRAJET) {
+        return;
+    }
+    position = apprentissagePosition();
+    if (trajet.nombre > 0 && trajet.points[trajet.nombre - 1] == position) {
+        return;
+    }
+    trajet.points[trajet.nombre++] = position;
+    apprentissage.modifie = 1;
+}
+
+/**
+ * Rejoue le trajet depuis son premier point, ou arrête de le rejouer.
+ */
+void apprentissageRejoue() {
+    if (apprentissage.lecture) {
+        apprentissage.lecture = 0;
+        machineDepuisBoucle(ARRETE);
+    } else if (trajet.nombre > 0 && mouvement.etat == ARRET) {
+        apprentissage.lecture = 1;
+        apprentissage.point = 0;
+        apprentissage.deplacement = 0;
+    }
+}
+
+/**
+ * Démarre le déplacement profilé vers le prochain point du trajet
+ * rejoué, dès que le précédent est terminé.
+ * Les points sont sur des pas entiers, comme tout arrêt: chaque
+ * déplacement arrive exactement sur son point. S'il s'est arrêté
+ * ailleurs, il a été interrompu (bouton, défaut...), et la lecture
+ * s'arrête aussi.
+ */
+void apprentissageLecture() {
+    int32_t position, distance;
+    unsigned char connu;
+
+    if (!apprentissage.lecture) {
+        return;
+    }
+    if (mouvement.etat == DEFAUT) {
+        apprentissage.lecture = 0;
+        return;
+    }
+    if (mouvement.etat != ARRET || profil.actif) {
+        return;
+    }
+
+    position = apprentissagePosition();
+    if (apprentissage.deplacement) {
+        apprentissage.deplacement = 0;
+        if (position != apprentissage.arrivee) {
+            apprentissage.lecture = 0;
+            return;
+        }
+    }
+
+    distance = trajet.points[apprentissage.point] - position;
+    if (distance == 0) {
+        if (++apprentissage.point >= trajet.nombre) {
+            apprentissage.lecture = 0;
+        }
+        return;
+    }
+    if (distance > APPRENTISSAGE_DISTANCE_MAX) {
+        distance = APPRENTISSAGE_DISTANCE_MAX;
+    } else if (distance < -APPRENTISSAGE_DISTANCE_MAX) {
+        distance = -APPRENTISSAGE_DISTANCE_MAX;
+    }
+    if (!profilDemarre(distance, 1, APPRENTISSAGE_ACCELERATION, &connu)) {
+        apprentissage.lecture = 0;
+        return;
+    }
+    apprentissage.arrivee = position + distance;
+    apprentissage.deplacement = 1;
+}
+
+/**
+ * Relève les boutons de l'apprentissage, rejoue le trajet, et le copie
+ * dans l'EEPROM s'il a changé.
+ * BOUTON_MEMORISE ajoute la position en cours au trajet; maintenu
+ * DUREE_EFFACEMENT, il l'efface. BOUTON_REJOUE rejoue le trajet, ou
+ * l'arrête. Les déplacements entre les points se font avec INT1 et
+ * INT2, comme sans apprentissage.
+ * À appeler depuis la boucle principale.
+ */
+void apprentissageTache() {
+    uint32_t maintenant;
+    unsigned char boutons, appuis;
+
+    if (apprentissage.modifie
+            && eepromCopie(EEPROM_TRAJET, &trajet, sizeof(struct Trajet))) {
+        apprentissage.modifie = 0;
+    }
+
+    apprentissageLecture();
+
+    maintenant = tempsEcoule();
+    if (maintenant - apprentissage.releve < PERIODE_BOUTONS) {
+        return;
+    }
+    apprentissage.releve = maintenant;
+
+    boutons = ~PORTC & (BOUTON_MEMORISE | BOUTON_REJOUE);
+    appuis = boutons & ~apprentissage.boutons;
+    apprentissage.boutons = boutons;
+    if (appuis & BOUTON_MEMORISE) {
+        apprentissage.appui = maintenant;
+        apprentissageMemorise();
+    } else if ((boutons & BOUTON_MEMORISE)
+            && maintenant - apprentissage.appui >= DUREE_EFFACEMENT) {
+        apprentissage.appui = maintenant;
+        apprentissage.lecture = 0;
+        trajet.nombre = 0;
+        apprentissage.modifie = 1;
+    }
+    if (appuis & BOUTON_REJOUE) {
+        apprentissageRejoue();
+    }
+}
+
+/**
+ * Envoie le trajet appris.
+ */
+void commandeTrajet() {
+    unsigned char n;
+
+    reponseEcrit(COMMANDE_TRAJET);
+    reponseEcrit(apprentissage.lecture);
+    reponseEcrit(trajet.nombre);
+    for (n = 0; n < TAILLE_TRAJET; n++) {
+        reponseEcrit32(trajet.points[n]);
+    }
+}
+#endif
+
+#ifdef SORTIE_EN_POSITION
+/**
+ * Règle le délai de la sortie «en position».
+ * @param delai Le délai, en interruptions du temporisateur 2.
+ */
+void commandeEnPosition(unsigned char delai) {
+    delaiEnPosition = delai;
+    reponseEcrit(COMMANDE_EN_POSITION);
+    reponseEcrit(delaiEnPosition);
+    reponseEcrit(SORTIE_EN_POSITION);
+}
+#endif
+
+/**
+ * Change le mode de décroissance du courant.
+ * @param mode Le nouveau mode.
+ */
+void commandeDecroissance(unsigned char mode) {
+    if (mode <= DECROISSANCE_AUCUNE) {
+        decroissanceMode = mode;
+    }
+    reponseEcrit(COMMANDE_DECROISSANCE);
+    reponseEcrit(decroissanceMode);
+}
+
+/**
+ * Rend le nombre d'octets de données qui suivent un code de commande.
+ * @param code Le code de la commande.
+ * @return Le nombre d'octets.
+ */
+unsigned char commandeLongueur(unsigned char code) {
+    switch(code) {
+        case COMMANDE_TABLE:
+            return 16 + 4;
+        case COMMANDE_LECTURE:
+            return 1;
+        case COMMANDE_ECHANTILLONS:
+            return 2 * ECHANTILLONS_BLOC;
+        case COMMANDE_SUIVI:
+            return 1;
+        case COMMANDE_TRAJECTOIRE:
+            return LONGUEUR_VARIABLE;
+        case COMMANDE_DECROISSANCE:
+            return 1;
+        case COMMANDE_PROFIL:
+            return 5;
+        case COMMANDE_PROFIL_CHANGE:
+            return 3;
+#ifdef CAPTEUR_INDEX
+        case COMMANDE_INDEX:
+            return 1;
+#endif
+#ifdef SORTIE_EN_POSITION
+        case COMMANDE_EN_POSITION:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Exécute une commande complète.
+ * Les codes inconnus sont ignorés.
+ * @param code Le code de la commande.
+ * @param donnees Les données qui suivent le code.
+ * @param longueur Le nombre d'octets de données.
+ */
+void commandeExecute(unsigned char code, unsigned char *donnees,
+        unsigned char longueur) {
+    switch(code) {
+        case COMMANDE_AVANCE:
+            machineDepuisBoucle(AVANCE);
+            break;
+        case COMMANDE_RECULE:
+            machineDepuisBoucle(RECULE);
+            break;
+        case COMMANDE_ARRETE:
+            machineDepuisBoucle(ARRETE);
+            break;
+        case COMMANDE_POSITION:
+            commandePosition();
+            break;
+        case COMMANDE_FREINAGE:
+            commandeFreinage();
+            break;
+        case COMMANDE_OBSERVATEUR:
+            commandeObservateur();
+            break;
+        case COMMANDE_JOURNAL:
+            commandeJournal();
+            break;
+        case COMMANDE_STATISTIQUES:
+            commandeStatistiques();
+            break;
+        case COMMANDE_TABLE:
+            commandeTable(donnees);
+            break;
+        case COMMANDE_LECTURE:
+            commandeLecture(donnees[0]);
+            break;
+        case COMMANDE_ECHANTILLONS:
+            commandeEchantillons(donnees);
+            break;
+        case COMMANDE_BILAN_LECTURE:
+            commandeBilanLecture();
+            break;
+        case COMMANDE_SUIVI:
+            commandeSuivi(donnees[0]);
+            break;
+        case COMMANDE_TRAJECTOIRE:
+            commandeTrajectoire(donnees, longueur);
+            break;
+        case COMMANDE_DECROISSANCE:
+            commandeDecroissance(donnees[0]);
+            break;
+        case COMMANDE_PROFIL:
+            commandeProfil(donnees);
+            break;
+        case COMMANDE_PROFIL_CHANGE:
+            commandeProfilChange(donnees);
+            break;
+#ifdef CAPTEUR_INDEX
+        case COMMANDE_INDEX:
+            commandeIndex(donnees[0]);
+            break;
+#endif
+#ifdef CALIBRATION_COURANT
+        case COMMANDE_CALIBRATION:
+            commandeCalibration();
+            break;
+#endif
+#ifdef APPRENTISSAGE
+        case COMMANDE_TRAJET:
+            commandeTrajet();
+            break;
+#endif
+#ifdef SORTIE_EN_POSITION
+        case COMMANDE_EN_POSITION:
+            commandeEnPosition(donnees[0]);
+            break;
+#endif
+    }
+}
+
+/**
+ * État de la lecture des commandes contenues dans une trame.
+ */
+static struct {
+    /** Code de la commande en cours.*/
+    unsigned char code;
+    /** 1 si le prochain octet est la longueur des données.*/
+    unsigned char lireLongueur;
+    /** Octets de données encore attendus.*/
+    unsigned char attendus;
+    /** Nombre total d'octets de données.*/
+    unsigned char longueur;
+    /** Octets de données déjà reçus.*/
+    unsigned char recus;
+    /** Données de la commande.*/
+    unsigned char donnees[TAILLE_DONNEES];
+} lecteur;
+
+/**
+ * Lit un octet de commande, et exécute la commande dès qu'elle est
+ * complète. Si une commande annonce plus de TAILLE_DONNEES octets, elle
+ * est lue puis ignorée.
+ * @param octet L'octet.
+ */
+void commandeOctet(unsigned char octet) {
+    if (lecteur.lireLongueur) {
+        lecteur.lireLongueur = 0;
+        lecteur.attendus = octet;
+        lecteur.longueur = octet;
+    } else if (lecteur.attendus == 0) {
+        lecteur.code = octet;
+        lecteur.attendus = commandeLongueur(octet);
+        lecteur.recus = 0;
+        if (lecteur.attendus == LONGUEUR_VARIABLE) {
+            lecteur.lireLongueur = 1;
+            return;
+        }
+        lecteur.longueur = lecteur.attendus;
+    } else {
+        if (lecteur.recus < TAILLE_DONNEES) {
+            lecteur.donnees[lecteur.recus] = octet;
+        }
+        lecteur.recus++;
+        lecteur.attendus--;
+    }
+    if (lecteur.attendus == 0 && lecteur.longueur <= TAILLE_DONNEES) {
+        commandeExecute(lecteur.code, lecteur.donnees, lecteur.longueur);
+    }
+}
+
+/**
+ * États d'une trame reçue, en tête de la réponse.
+ */
+/** La trame est exécutée; ses réponses suivent.*/
+#define TRAME_ACCEPTEE 0
+/** La trame avait déjà été acceptée; ses réponses suivent à nouveau.*/
+#define TRAME_REPETEE 1
+/** La trame n'est pas celle attendue; elle est ignorée.*/
+#define TRAME_HORS_SEQUENCE 2
+/** Le CRC de la trame est faux; elle est ignorée.*/
+#define TRAME_CORROMPUE 3
+
+/**
+ * Trame de réponse en cours d'envoi. Elle peut être plus longue que le
+ * tampon d'émission: ses octets y sont mis à mesure qu'il se vide.
+ */
+static struct {
+    /** SYNCHRONISATION, longueur, acquittement et état.*/
+    unsigned char entete[4];
+    /** Réponses à la suite de l'état.*/
+    unsigned char *donnees;
+    /** CRC de la trame.*/
+    unsigned char crc;
+    /** Octets de la trame déjà mis dans le tampon, et leur total.*/
+    unsigned char envoyes;
+    unsigned char total;
+} envoi;
+
+/**
+ * Met la suite de la trame de réponse en cours dans le tampon
+ * d'émission, tant qu'il a de la place.
+ * @return 1 si la trame est entièrement dans le tampon.
+ */
+unsigned char trameEmet() {
+    unsigned char n, octet;
+
+    while (envoi.envoyes < envoi.total) {
+        n = envoi.envoyes;
+        if (n < 4) {
+            octet = envoi.entete[n];
+        } else if (n < envoi.total - 1) {
+            octet = envoi.donnees[n - 4];
+        } else {
+            octet = envoi.crc;
+        }
+        if (!serieEcrit(octet)) {
+            return 0;
+        }
+        envoi.envoyes++;
+    }
+    return 1;
+}
+
+/**
+ * Commence l'envoi d'une trame de réponse: SYNCHRONISATION, longueur
+ * des données, acquittement, données, CRC. Le CRC porte sur la
+ * longueur, l'acquittement et les données. Ce qui ne tient pas dans le
+ * tampon d'émission est envoyé par trameTache(), sans attendre.
+ * @param acquittement Numéro de la prochaine trame attendue.
+ * @param etat État de la trame reçue.
+ * @param donnees Réponses à la suite de l'état; elles ne doivent pas
+ * changer avant la fin de l'envoi.
+ * @param longueur Longueur des réponses.
+ */
+void trameEnvoie(unsigned char acquittement, unsigned char etat,
+        unsigned char *donnees, unsigned char longueur) {
+    unsigned char crc = 0;
+    unsigned char n;
+
+    envoi.entete[0] = SYNCHRONISATION;
+    envoi.entete[1] = longueur + 1;
+    envoi.entete[2] = acquittement;
+    envoi.entete[3] = etat;
+    for (n = 1; n < 4; n++) {
+        crc = crc8(crc, envoi.entete[n]);
+    }
+    for (n = 0; n < longueur; n++) {
+        crc = crc8(crc, donnees[n]);
+    }
+    envoi.donnees = donnees;
+    envoi.crc = crc;
+    envoi.envoyes = 0;
+    envoi.total = 4 + longueur + 1;
+    trameEmet();
+}
+
+/**
+ * Traite une trame reçue.
+ * Une commande ne peut pas être coupée entre deux trames.
+ * Les trames sont exécutées dans l'ordre de leur numéro de séquence.
+ * Chaque trame reçue reçoit une réponse, dont l'acquittement est le
+ * numéro de la prochaine trame attendue: l'hôte peut envoyer jusqu'à
+ * FENETRE trames d'avance, et reprendre à l'acquittement s'il en manque
+ * une (fenêtre glissante). Après un redémarrage du contrôleur,
+ * l'acquittement de la première réponse indique à l'hôte le numéro à
+ * utiliser.
+ * @param sequence Numéro de séquence de la trame.
+ * @param donnees Commandes contenues dans la trame.
+ * @param longueur Longueur des commandes.
+ * @param valide 1 si le CRC est correct.
+ */
+void trameTraite(unsigned char sequence, unsigned char *donnees,
+        unsigned char longueur, unsigned char valide) {
+    static unsigned char attendue = 0;
+    unsigned char n;
+
+    if (!valide) {
+        trameEnvoie(attendue, TRAME_CORROMPUE, 0, 0);
+    } else if (sequence == attendue) {
+        trameReponseLongueur = 0;
+        lecteur.lireLongueur = 0;
+        lecteur.attendus = 0;
+        for (n = 0; n < longueur; n++) {
+            commandeOctet(donnees[n]);
+        }
+        attendue++;
+        trameEnvoie(attendue, TRAME_ACCEPTEE,
+                trameReponse, trameReponseLongueur);
+    } else if ((unsigned char) (sequence + 1) == attendue) {
+        trameEnvoie(attendue, TRAME_REPETEE,
+                trameReponse, trameReponseLongueur);
+    } else {
+        trameEnvoie(attendue, TRAME_HORS_SEQUENCE, 0, 0);
+    }
+}
+
+/**
+ * Étapes de la réception d'une trame.
+ */
+enum EtapeTrame {
+    /** Attend l'octet de synchronisation.*/
+    TRAME_SYNCHRONISATION,
+    /** Attend la longueur des données.*/
+    TRAME_LONGUEUR,
+    /** Attend le numéro de séquence.*/
+    TRAME_SEQUENCE,
+    /** Reçoit les données.*/
+    TRAME_DONNEES,
+    /** Attend le CRC.*/
+    TRAME_CRC
+};
+
+/**
+ * Reçoit les trames de la liaison série: SYNCHRONISATION, longueur des
+ * données (au plus TAILLE_TRAME), numéro de séquence, données, CRC.
+ * Le CRC porte sur la longueur, le numéro de séquence et les données.
+ * Tant que la réponse précédente n'est pas entièrement dans le tampon
+ * d'émission, les octets reçus attendent dans le tampon de réception.
+ * À appeler depuis la boucle principale.
+ */
+void trameTache() {
+    static enum EtapeTrame etape = TRAME_SYNCHRONISATION;
+    static unsigned char longueur;
+    static unsigned char sequence;
+    static unsigned char recus;
+    static unsigned char crc;
+    static unsigned char donnees[TAILLE_TRAME];
+
+    unsigned char octet;
+
+    if (!trameEmet()) {
+        return;
+    }
+
+    // Une trame dont les octets n'arrivent plus est abandonnée. Le délai
+    // ne compte que tampon vide: les octets en attente sont arrivés à
+    // temps, même si la boucle principale a tardé à les lire:
+    if (!serieDisponible()) {
+        if (etape != TRAME_SYNCHRONISATION
+                && serieSilence() > DELAI_TRAME) {
+            etape = TRAME_SYNCHRONISATION;
+        }
+        return;
+    }
+
+    while (serieDisponible()) {
+        octet = serieLit();
+        switch(etape) {
+            case TRAME_SYNCHRONISATION:
+                if (octet == SYNCHRONISATION) {
+                    crc = 0;
+                    etape = TRAME_LONGUEUR;
+                }
+                break;
+            case TRAME_LONGUEUR:
+                if (octet > TAILLE_TRAME) {
+                    etape = TRAME_SYNCHRONISATION;
+                    break;
+                }
+                longueur = octet;
+                crc = crc8(crc, octet);
+                etape = TRAME_SEQUENCE;
+                break;
+            case TRAME_SEQUENCE:
+                sequence = octet;
+                crc = crc8(crc, octet);
+                recus = 0;
+                if (longueur > 0) {
+                    etape = TRAME_DONNEES;
+                } else {
+                    etape = TRAME_CRC;
+                }
+                break;
+            case TRAME_DONNEES:
+                donnees[recus++] = octet;
+                crc = crc8(crc, octet);
+                if (recus == longueur) {
+                    etape = TRAME_CRC;
+                }
+                break;
+            case TRAME_CRC:
+                etape = TRAME_SYNCHRONISATION;
+                trameTraite(sequence, donnees, longueur, octet == crc);
+                if (!trameEmet()) {
+                    return;
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * Point d'entrée du programme.
+ * Configure le port A comme sortie, le temporisateur 2, le module
+ * CCP3 et les interruptions INT0 et INT1.
+ */
+void main() {
+    ANSELA = 0x00;      // Désactive les convertisseurs A/D.
+    ANSELB = 0x00;      // Désactive les convertisseurs A/D.
+    ANSELC = 0x00;      // Désactive les convertisseurs A/D.
+
+    TRISA = 0x00;       // Tous les bits du port A comme sorties.
+
+
+    // Active le PWM sur CCP5:
+    T2CONbits.T2CKPS = 1;       // Pas de diviseur de fréq. en entrée.
+    T2CONbits.T2OUTPS = 8;      // Pour ménager le traitement d'int.
+    PR2 = 32;                   // Période du tmr2: 32
+    T4CONbits.T4CKPS = 1;       // Tmr4 comme le tmr2...
+    T4CONbits.T4OUTPS = 0;      // ... mais une int. par période du PWM.
+    PR4 = 32;
+    T2CONbits.TMR2ON = 1;       // Active le tmr2
+    T4CONbits.TMR4ON = 1;       // Active le tmr4, en phase avec le tmr2.
+    CCPTMRS0bits.C3TSEL = 0;    // CCP3 branché sur tmr2
+    CCP3CONbits.P3M = 2;        // Mode demi-pont.
+    CCP3CONbits.CCP3M = 0xC;    // Active le CCP3.
+
+    TRISBbits.RB5 = 0;          // Active la sortie P3A.
+    TRISCbits.RC7 = 0;          // Active la sortie P3B.
+
+#ifdef HACHAGE_MATERIEL
+    // Le DAC produit la consigne de courant entre Vss et Vdd:
+    VREFCON1bits.DACPSS = 0;    // Référence positive: Vdd.
+    VREFCON1bits.DACNSS = 0;    // Référence négative: Vss.
+    VREFCON1bits.DACOE = 0;     // Pas de sortie sur RA2 (pont).
+    VREFCON1bits.DACEN = 1;     // Active le DAC.
+
+    // Le comparateur C2 compare le shunt avec la consigne:
+    TRISBbits.RB3 = 1;          // C12IN2- comme entrée...
+    ANSELBbits.ANSB3 = 1;       // ... analogique.
+    CM2CON1bits.C2RSEL = 0;     // C2VREF vient du DAC.
+    CM2CON1bits.C2HYS = 1;      // Hystérésis contre les rebonds.
+    CM2CON0bits.C2CH = 2;       // C2VIN- sur C12IN2- (shunt).
+    CM2CON0bits.C2R = 1;        // C2VIN+ sur C2VREF (consigne).
+    CM2CON0bits.C2POL = 1;      // C2OUT à 1 si le shunt dépasse.
+    CM2CON0bits.C2SP = 1;       // Mode rapide.
+    CM2CON0bits.C2ON = 1;       // Active le comparateur.
+
+    // C2OUT coupe le ECCP3, qui redémarre à la période suivante:
+    CCP3ASbits.PSS3AC = 0;      // P3A à 0 pendant la coupure.
+    CCP3ASbits.PSS3BD = 0;      // P3B à 0 pendant la coupure.
+    PWM3CONbits.P3RSEN = 1;     // Redémarrage automatique.
+#endif
+
+    // L'entrée de défaut FLT0 (INT0, active à 0) coupe le ECCP3 en
+    // moins d'un cycle d'instruction, et déclenche une interruption
+    // pour que la machine à états garde le ECCP3 coupé:
+    TRISBbits.RB0 = 1;          // FLT0 / INT0 comme entrée digitale.
+    WPUBbits.WPUB0 = 1;         // Au repos si elle n'est pas connectée.
+#ifdef HACHAGE_MATERIEL
+    CCP3ASbits.CCP3AS = 6;      // Coupure sur FLT0 ou C2OUT.
+#else
+    CCP3ASbits.CCP3AS = 4;      // Coupure sur FLT0.
+    CCP3ASbits.PSS3AC = 0;      // P3A à 0 pendant la coupure.
+    CCP3ASbits.PSS3BD = 0;      // P3B à 0 pendant la coupure.
+#endif
+    INTCON2bits.INTEDG0 = 0;    // Int. de INT0 sur flanc descendant.
+    INTCONbits.INT0IF = 0;      // Baisse le drapeau.
+    INTCONbits.INT0IE = 1;      // INT0 est toujours en haute priorité.
+
+    PORTA = 9;
+    PORTB = 0x00;
+    PORTC = 0xFF;
+
+    // Le temporisateur 0 donne la base de temps d'une milliseconde,
+    // en basse priorité pour ne pas retarder les pas du moteur:
+    T0CONbits.T08BIT = 1;       // Mode 8 bits.
+    T0CONbits.T0CS = 0;         // Horloge: Fosc/4.
+    T0CONbits.PSA = 1;          // Pas de diviseur de fréq. en entrée.
+    TMR0L = RECHARGE_TMR0;
+    INTCON2bits.TMR0IP = 0;     // En basse priorité.
+    INTCONbits.TMR0IF = 0;      // Baisse le drapeau.
+    INTCONbits.TMR0IE = 1;      // Active les interruptions.
+    T0CONbits.TMR0ON = 1;       // Active le tmr0.
+
+    // Liaison série EUSART2 à 9600 bauds, 8 bits, sans parité, sur
+    // RB6 (TX2) et RB7 (RX2), en basse priorité:
+    TRISBbits.RB6 = 1;          // Le EUSART prend en charge...
+    TRISBbits.RB7 = 1;          // ... la direction des broches.
+    BAUDCON2bits.BRG16 = 1;     // Générateur de bauds de 16 bits.
+    TXSTA2bits.BRGH = 1;        // Vitesse haute.
+    SPBRGH2 = VITESSE_SERIE >> 8;
+    SPBRG2 = VITESSE_SERIE & 0xFF;
+    TXSTA2bits.SYNC = 0;        // Mode asynchrone.
+    RCSTA2bits.SPEN = 1;        // Active le EUSART2.
+    TXSTA2bits.TXEN = 1;        // Active l'émission.
+    RCSTA2bits.CREN = 1;        // Active la réception.
+    IPR3bits.RC2IP = 0;         // Réception en basse priorité.
+    IPR3bits.TX2IP = 0;         // Émission en basse priorité.
+    PIE3bits.RC2IE = 1;         // Interruptions de réception.
+
+    // Prépare les interruptions de haute priorité temporisateur 2:
+    PIE1bits.TMR2IE = 0;        // Activées au premier déplacement.
+    IPR1bits.TMR2IP = 1;        // En haute priorité.
+    PIR1bits.TMR2IF = 0;        // Baisse le drapeau.
+    PIE5bits.TMR4IE = 0;        // Temporisateur 4: pendant les...
+    IPR5bits.TMR4IP = 1;        // ... décroissances, en haute priorité.
+    PIR5bits.TMR4IF = 0;
+
+    // Prépare les interruptions de basse priorité INT1 et INT2:
+    TRISBbits.RB2 = 1;          // INT2 comme entrée digitale.
+    TRISBbits.RB1 = 1;          // INT1 comme entrée digitale.
+
+    INTCON2bits.RBPU=0;         // Active les résistances de tirage...
+    WPUBbits.WPUB2 = 1;         // ... sur INT2 ...
+    WPUBbits.WPUB1 = 1;         // ... et INT1.
+
+    INTCON2bits.INTEDG2 = 0;    // Int. de INT2 sur flanc descendant.
+    INTCON2bits.INTEDG1 = 0;    // Int. de INT1 sur flanc descendant.
+
+    INTCON3bits.INT2IE = 1;     // Interruptions pour INT2...
+    INTCON3bits.INT2IP = 1;     // ... en basse priorité.
+    INTCON3bits.INT1IE = 1;     // Interruptions pour INT1...
+    INTCON3bits.INT1IP = 1;     // ... en basse priorité.
+
+#ifdef CAPTEUR_INDEX
+    // Le capteur d'index déclenche une interruption de haute priorité
+    // à chaque changement de RB4:
+    TRISBbits.RB4 = 1;          // RB4 comme entrée digitale.
+    IOCBbits.IOCB4 = 1;         // Interruption sur changement de RB4.
+    INTCON2bits.RBIP = 1;       // En haute priorité.
+    capteurIndex.ouverte = PORTBbits.RB4;
+    INTCONbits.RBIF = 0;        // Baisse le drapeau.
+    INTCONbits.RBIE = 1;        // Active les interruptions.
+#endif
+
+#ifdef APPRENTISSAGE
+    // Les boutons de l'apprentissage sont relevés par la boucle
+    // principale:
+    TRISCbits.RC0 = 1;          // BOUTON_MEMORISE comme entrée...
+    TRISCbits.RC1 = 1;          // ... et BOUTON_REJOUE.
+#endif
+
+#ifdef SORTIE_EN_POSITION
+    // Le moteur n'est en position qu'après son premier mouvement:
+    SORTIE_EN_POSITION = 0;
+    DIRECTION_EN_POSITION = 0;  // Comme sortie.
+#endif
+
+#ifdef CALIBRATION_COURANT
+    // Équilibre le courant des bobines avant le premier mouvement:
+    calibrationInitialise();
+#endif
+#ifdef COMMUTATION_RAPIDE
+    tablePrepare(&tables[0]);
+#endif
+
+    // Active les interruptions de haute et de basse priorité:
+    RCONbits.IPEN = 1;
+    INTCONbits.GIEH = 1;
+    INTCONbits.GIEL = 1;
+
+    // Place le moteur en position arrêtée sur le pas 0:
+    commutationStationnement(0);
+
+    // Récupère les statistiques de vie et le journal des défauts:
+    statistiquesInitialise();
+    journalInitialise();
+#ifdef APPRENTISSAGE
+    apprentissageInitialise();
+#endif
+
+    // Les tâches de fond se partagent le temps libre:
+    while(1) {
+        trameTache();
+        statistiquesTache();
+        journalTache();
+        eepromTache();
+        profilTache();
+#ifdef APPRENTISSAGE
+        apprentissageTache();
+#endif
+        observateurTache();
+#ifdef CAPTEUR_INDEX
+        indexTache();
+#endif
+    }
+}
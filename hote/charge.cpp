@@ -0,0 +1,282 @@
+/*
+ * Test de charge de la liaison de commande.
+ * Inonde le contrôleur de commandes mélangées (positions, statistiques,
+ * marche et arrêt) en gardant plusieurs commandes en attente, puis
+ * démarre des mouvements un par un. Mesure:
+ * - Le nombre de commandes par seconde, et le délai aller-retour de
+ *   chaque commande (p50, p99).
+ * - Le délai entre la fin de la trame qui démarre un mouvement et le
+ *   premier pas, et le retard des TICTAC dans interruptionsHP() pendant
+ *   la charge (simulateur seulement).
+ * - Le temps processeur de l'hôte par commande, d'où le nombre d'axes
+ *   qu'un coeur de l'hôte peut commander, chaque axe ayant sa liaison.
+ *
+ * Usage: charge [-p port] [-x facteur] [-d secondes] [-f profondeur]
+ *               [-n mouvements]
+ *   -p port       Contrôleur à tester. Par défaut, lance ./simulateur.
+ *   -x facteur    Vitesse du simulateur (voir simulateur.c).
+ *   -d secondes   Durée de l'inondation. Par défaut 5.
+ *   -f profondeur Commandes en attente de réponse. Par défaut 8.
+ *   -n mouvements Nombre de démarrages mesurés. Par défaut 20.
+ */
+#include "controleur.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace controleur;
+using Horloge = std::chrono::steady_clock;
+
+namespace {
+
+/** Durée d'un cycle d'instruction du contrôleur, en µs.*/
+constexpr double US_PAR_CYCLE = 4;
+
+/**
+ * Simulateur lancé pour le test.
+ */
+struct Simulateur {
+    pid_t pid = -1;
+    std::string port;
+    std::string mesures;
+
+    /**
+     * Lance le simulateur, et attend le nom de son pseudo-terminal.
+     * @param facteur Vitesse du temps simulé.
+     */
+    void lance(const std::string &facteur) {
+        int tube[2];
+        port = "/tmp/charge-" + std::to_string(getpid());
+        mesures = port + ".mesures";
+        if (pipe(tube) != 0) {
+            throw std::runtime_error("pipe");
+        }
+        pid = fork();
+        if (pid == 0) {
+            dup2(tube[1], STDOUT_FILENO);
+            close(tube[0]);
+            execl("./simulateur", "simulateur", "-l", port.c_str(),
+                    "-m", mesures.c_str(), "-x", facteur.c_str(),
+                    static_cast<char *>(nullptr));
+            _exit(127);
+        }
+        close(tube[1]);
+        char nom[256];
+        ssize_t n = read(tube[0], nom, sizeof(nom));
+        close(tube[0]);
+        if (n <= 0) {
+            throw std::runtime_error("./simulateur ne démarre pas");
+        }
+    }
+
+    /**
+     * Arrête le simulateur, et lit ses mesures.
+     * @return Les mesures, par nom.
+     */
+    std::map<std::string, double> arrete() {
+        std::map<std::string, double> valeurs;
+        if (pid <= 0) {
+            return valeurs;
+        }
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+        std::ifstream f(mesures);
+        std::string nom;
+        double valeur;
+        while (f >> nom >> valeur) {
+            valeurs[nom] = valeur;
+        }
+        std::remove(mesures.c_str());
+        return valeurs;
+    }
+};
+
+/**
+ * Rend le percentile p d'une liste de durées, en ms.
+ */
+double percentile(std::vector<double> durees, double p) {
+    if (durees.empty()) {
+        return 0;
+    }
+    std::sort(durees.begin(), durees.end());
+    return durees[static_cast<std::size_t>(p * (durees.size() - 1))];
+}
+
+/**
+ * Temps processeur consommé par le processus, en s.
+ */
+double tempsProcesseur() {
+    struct rusage r;
+    getrusage(RUSAGE_SELF, &r);
+    return r.ru_utime.tv_sec + r.ru_stime.tv_sec
+            + (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1e6;
+}
+
+double ms(Horloge::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+/**
+ * Attend que le moteur soit arrêté.
+ */
+void attendArret(Controleur &controleur) {
+    while (controleur.position().get().etat != Etat::ARRET) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::string port;
+    std::string facteur = "1";
+    double secondes = 5;
+    std::size_t profondeur = 8;
+    int mouvements = 20;
+    int option;
+
+    while ((option = getopt(argc, argv, "p:x:d:f:n:")) != -1) {
+        switch (option) {
+            case 'p': port = optarg; break;
+            case 'x': facteur = optarg; break;
+            case 'd': secondes = std::atof(optarg); break;
+            case 'f': profondeur = std::atoi(optarg); break;
+            case 'n': mouvements = std::atoi(optarg); break;
+            default:
+                std::cerr << "Usage: " << argv[0] << " [-p port] [-x facteur]"
+                        " [-d secondes] [-f profondeur] [-n mouvements]\n";
+                return 1;
+        }
+    }
+
+    Simulateur simulateur;
+    try {
+        if (port.empty()) {
+            simulateur.lance(facteur);
+            port = simulateur.port;
+        }
+        Controleur controleur(port);
+        std::mt19937 hasard(1);
+
+        // Inondation: 8 positions, 1 statistiques et 1 marche ou arrêt
+        // sur 10 commandes.
+        struct Envoi {
+            Horloge::time_point depart;
+            std::future<void> fin;
+        };
+        std::deque<Envoi> envois;
+        std::vector<double> allersRetours;
+        unsigned long numero = 0;
+        double processeur = tempsProcesseur();
+        auto debut = Horloge::now();
+        auto limite = debut + std::chrono::duration<double>(secondes);
+
+        auto termineUn = [&]() {
+            envois.front().fin.get();
+            allersRetours.push_back(ms(Horloge::now() - envois.front().depart));
+            envois.pop_front();
+        };
+        while (Horloge::now() < limite) {
+            while (envois.size() >= profondeur) {
+                termineUn();
+            }
+            Envoi envoi;
+            envoi.depart = Horloge::now();
+            switch (numero++ % 10) {
+                case 4:
+                    envoi.fin = std::async(std::launch::deferred,
+                            [f = controleur.statistiques().share()]() {
+                                f.get();
+                            });
+                    break;
+                case 9:
+                    envoi.fin = (numero / 10) % 2
+                            ? controleur.avance() : controleur.arrete();
+                    break;
+                default:
+                    envoi.fin = std::async(std::launch::deferred,
+                            [f = controleur.position().share()]() {
+                                f.get();
+                            });
+                    break;
+            }
+            envois.push_back(std::move(envoi));
+        }
+        while (!envois.empty()) {
+            termineUn();
+        }
+        double duree = std::chrono::duration<double>(
+                Horloge::now() - debut).count();
+        processeur = tempsProcesseur() - processeur;
+
+        // Démarrages, un par un:
+        std::vector<double> acquittements;
+        controleur.arrete().get();
+        for (int n = 0; n < mouvements; n++) {
+            attendArret(controleur);
+            std::this_thread::sleep_for(std::chrono::milliseconds(
+                    20 + hasard() % 10));
+            auto depart = Horloge::now();
+            controleur.avance().get();
+            acquittements.push_back(ms(Horloge::now() - depart));
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            controleur.arrete().get();
+        }
+        attendArret(controleur);
+
+        std::size_t commandes = allersRetours.size();
+        std::printf("Inondation: %zu commandes en %.2fs, profondeur %zu\n",
+                commandes, duree, profondeur);
+        std::printf("  commandes/s          %.1f\n", commandes / duree);
+        std::printf("  aller-retour p50     %.2fms\n",
+                percentile(allersRetours, 0.50));
+        std::printf("  aller-retour p99     %.2fms\n",
+                percentile(allersRetours, 0.99));
+        std::printf("  trames réémises      %lu\n", controleur.reemissions());
+        double usParCommande = processeur * 1e6 / commandes;
+        std::printf("  processeur hôte      %.1fµs par commande\n",
+                usParCommande);
+        std::printf("  axes par coeur       %.0f\n",
+                1e6 / (usParCommande * commandes / duree));
+        std::printf("Démarrages: %d\n", mouvements);
+        std::printf("  acquittement p50     %.2fms\n",
+                percentile(acquittements, 0.50));
+        std::printf("  acquittement p99     %.2fms\n",
+                percentile(acquittements, 0.99));
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        simulateur.arrete();
+        return 1;
+    }
+
+    auto mesures = simulateur.arrete();
+    if (!mesures.empty()) {
+        std::printf("Contrôleur simulé:\n");
+        std::printf("  trame -> 1er pas p50 %.2fms\n",
+                mesures["mouvement_p50"] * US_PAR_CYCLE / 1000);
+        std::printf("  trame -> 1er pas p99 %.2fms\n",
+                mesures["mouvement_p99"] * US_PAR_CYCLE / 1000);
+        std::printf("  interruptionsHP()    %.0f appels, %.0fµs en moyenne,"
+                " %.0fµs au plus\n", mesures["hp_appels"],
+                mesures["hp_moyen"] * US_PAR_CYCLE,
+                mesures["hp_maximum"] * US_PAR_CYCLE);
+        std::printf("  interruptionsBP()    %.0f appels, %.0fµs en moyenne,"
+                " %.0fµs au plus\n", mesures["bp_appels"],
+                mesures["bp_moyen"] * US_PAR_CYCLE,
+                mesures["bp_maximum"] * US_PAR_CYCLE);
+        std::printf("  retard des TICTAC    %.0fµs en moyenne, %.0fµs au plus\n",
+                mesures["tictac_retard_moyen"] * US_PAR_CYCLE,
+                mesures["tictac_retard_maximum"] * US_PAR_CYCLE);
+    }
+    return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Envoie des commandes au contrôleur depuis la ligne de commande.
+ * Usage: commande <port> <action>...
+ * Les actions sont avance, recule, arrete, position, freinage,
+ * observateur, calibration, trajet, statistiques, journal,
+ * decroissance=<lente|rapide|mixte|aucune>, index, index=correction,
+ * index=reference,
+ * profil=<distance>,<intervalle>,<acceleration>,
+ * change=<intervalle>,<acceleration>, enposition=<delai> et
+ * attends=<ms>.
+ * Elles sont envoyées sans attendre les réponses, qui sont affichées
+ * dans l'ordre. Seule index=correction laisse la correction des pas
+ * perdus en service.
+ */
+#include "controleur.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <variant>
+
+using namespace controleur;
+
+namespace {
+
+const char *nomEtat(Etat etat) {
+    static const char *noms[] = {
+        "ARRET", "MARCHE_AVANT", "FREIN_AVANT", "MARCHE_ARRIERE",
+        "FREIN_ARRIERE", "DEFAUT", "LECTURE", "SUIVI"
+    };
+    auto n = static_cast<std::size_t>(etat);
+    return n < sizeof(noms) / sizeof(noms[0]) ? noms[n] : "?";
+}
+
+const char *nomDecroissance(Decroissance mode) {
+    static const char *noms[] = { "lente", "rapide", "mixte", "aucune" };
+    auto n = static_cast<std::size_t>(mode);
+    return n < sizeof(noms) / sizeof(noms[0]) ? noms[n] : "?";
+}
+
+void affiche(const std::string &action, std::future<void> &f) {
+    f.get();
+    std::cout << action << ": ok\n";
+}
+
+void affiche(const std::string &action, std::future<Position> &f) {
+    Position p = f.get();
+    std::cout << action << ": " << nomEtat(p.etat)
+            << " " << p.position << "\n";
+}
+
+void affiche(const std::string &action, std::future<Freinage> &f) {
+    Freinage p = f.get();
+    std::cout << action << ": " << nomEtat(p.etat)
+            << " arret=" << p.position
+            << " dans " << p.duree << "ms\n";
+}
+
+void affiche(const std::string &action, std::future<Observation> &f) {
+    Observation o = f.get();
+    std::cout << action << ": " << o.position
+            << " vitesse=" << o.vitesse / 16.0 << "/s"
+            << " residu=" << o.residu / 256.0 << "\n";
+}
+
+void affiche(const std::string &action, std::future<Calibration> &f) {
+    Calibration c = f.get();
+    std::cout << action << ": correction=" << int(c.correction)
+            << (c.mesuree ? " mesurée" : " conservée")
+            << " pont1=" << c.pont1 << "/" << c.pont1Ecart
+            << " pont2=" << c.pont2 << "\n";
+}
+
+void affiche(const std::string &action, std::future<Trajet> &f) {
+    Trajet t = f.get();
+    std::cout << action << ":" << (t.lecture ? " (rejoué)" : "");
+    for (std::int32_t point : t.points) {
+        std::cout << " " << point;
+    }
+    std::cout << "\n";
+}
+
+void affiche(const std::string &action, std::future<EnPosition> &f) {
+    EnPosition p = f.get();
+    std::cout << action << ": "
+            << (p.sortie ? "en position" : "hors position")
+            << " delai=" << int(p.delai) << "\n";
+}
+
+void affiche(const std::string &action, std::future<Decroissance> &f) {
+    std::cout << action << ": " << nomDecroissance(f.get()) << "\n";
+}
+
+void affiche(const std::string &action, std::future<BilanIndex> &f) {
+    BilanIndex b = f.get();
+    std::cout << action << ":"
+            << " reference=" << (b.referenceValide ? "oui" : "non")
+            << " tours=" << b.tours
+            << " derive=" << b.derive
+            << " corrections=" << b.corrections
+            << " dernier=" << b.temps << "ms\n";
+}
+
+void affiche(const std::string &action, std::future<Profil> &f) {
+    Profil p = f.get();
+    std::cout << action << ": " << (p.enCours ? "démarré" : "refusé")
+            << (p.planConnu ? ", plan en mémoire" : "") << "\n";
+}
+
+void affiche(const std::string &action, std::future<bool> &f) {
+    std::cout << action << ": " << (f.get() ? "accepté" : "refusé") << "\n";
+}
+
+void affiche(const std::string &action, std::future<Statistiques> &f) {
+    Statistiques s = f.get();
+    std::cout << action << ":"
+            << " avant=" << s.microPasAvant
+            << " arriere=" << s.microPasArriere
+            << " duree=" << s.dureeMouvements << "ms"
+            << " mouvements=" << s.mouvements
+            << " freinages=" << s.freinages
+            << " defauts=" << s.defauts
+            << " vitesseMax=" << s.vitesseMax
+            << " dernier=" << s.dernierMicroPas
+            << "/" << s.dureePrevue << "ms/" << s.dureeReelle << "ms\n";
+}
+
+void affiche(const std::string &action,
+        std::future<std::vector<EntreeJournal>> &f) {
+    std::cout << action << ":\n";
+    for (const EntreeJournal &e : f.get()) {
+        std::cout << "  " << e.temps << "ms code=" << int(e.code)
+                << " etat=" << int(e.etat) << " pas=" << int(e.pas)
+                << " position=" << e.position
+                << " commande=" << int(e.commande) << "\n";
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    using Reponse = std::variant<std::future<void>, std::future<Position>,
+            std::future<Freinage>, std::future<Observation>,
+            std::future<Calibration>, std::future<Trajet>,
+            std::future<EnPosition>,
+            std::future<Statistiques>,
+            std::future<Decroissance>,
+            std::future<BilanIndex>, std::future<Profil>, std::future<bool>,
+            std::future<std::vector<EntreeJournal>>>;
+
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <port> <action>...\n";
+        return 1;
+    }
+    try {
+        Controleur controleur(argv[1]);
+        std::vector<std::pair<std::string, Reponse>> reponses;
+
+        for (int n = 2; n < argc; n++) {
+            std::string action = argv[n];
+            if (action == "avance") {
+                reponses.emplace_back(action, controleur.avance());
+            } else if (action == "recule") {
+                reponses.emplace_back(action, controleur.recule());
+            } else if (action == "arrete") {
+                reponses.emplace_back(action, controleur.arrete());
+            } else if (action == "position") {
+                reponses.emplace_back(action, controleur.position());
+            } else if (action == "freinage") {
+                reponses.emplace_back(action, controleur.freinage());
+            } else if (action == "observateur") {
+                reponses.emplace_back(action, controleur.observateur());
+            } else if (action == "calibration") {
+                reponses.emplace_back(action, controleur.calibration());
+            } else if (action == "trajet") {
+                reponses.emplace_back(action, controleur.trajet());
+            } else if (action == "statistiques") {
+                reponses.emplace_back(action, controleur.statistiques());
+            } else if (action == "journal") {
+                reponses.emplace_back(action, controleur.journal());
+            } else if (action.rfind("decroissance=", 0) == 0) {
+                std::string nom = action.substr(13);
+                Decroissance mode = Decroissance::MIXTE;
+                if (nom == "lente") {
+                    mode = Decroissance::LENTE;
+                } else if (nom == "rapide") {
+                    mode = Decroissance::RAPIDE;
+                } else if (nom == "aucune") {
+                    mode = Decroissance::AUCUNE;
+                } else if (nom != "mixte") {
+                    std::cerr << nom << ": décroissance inconnue\n";
+                    return 1;
+                }
+                reponses.emplace_back(action, controleur.decroissance(mode));
+            } else if (action == "index") {
+                reponses.emplace_back(action, controleur.capteurIndex(0));
+            } else if (action == "index=correction") {
+                reponses.emplace_back(action,
+                        controleur.capteurIndex(INDEX_CORRECTION));
+            } else if (action == "index=reference") {
+                reponses.emplace_back(action,
+                        controleur.capteurIndex(INDEX_REFERENCE));
+            } else if (action.rfind("profil=", 0) == 0) {
+                int distance, croisiere, acceleration;
+                if (std::sscanf(action.c_str() + 7, "%d,%d,%d", &distance,
+                        &croisiere, &acceleration) != 3) {
+                    std::cerr << action << ": profil incomplet\n";
+                    return 1;
+                }
+                reponses.emplace_back(action, controleur.profil(distance,
+                        croisiere, acceleration));
+            } else if (action.rfind("change=", 0) == 0) {
+                int croisiere, acceleration;
+                if (std::sscanf(action.c_str() + 7, "%d,%d", &croisiere,
+                        &acceleration) != 2) {
+                    std::cerr << action << ": changement incomplet\n";
+                    return 1;
+                }
+                reponses.emplace_back(action, controleur.profilChange(
+                        croisiere, acceleration));
+            } else if (action.rfind("enposition=", 0) == 0) {
+                reponses.emplace_back(action, controleur.enPosition(
+                        std::stoi(action.substr(11))));
+            } else if (action.rfind("attends=", 0) == 0) {
+                std::this_thread::sleep_for(
+                        std::chrono::milliseconds(std::stoi(action.substr(8))));
+            } else {
+                std::cerr << action << ": action inconnue\n";
+                return 1;
+            }
+        }
+        for (auto &[action, reponse] : reponses) {
+            std::visit([&](auto &f) { affiche(action, f); }, reponse);
+        }
+        if (controleur.reemissions() > 0) {
+            std::cout << controleur.reemissions() << " trames réémises\n";
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,716 @@
+/*
+ * Client du contrôleur de moteur pas à pas, pour l'hôte.
+ */
+#include "controleur.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace controleur {
+
+namespace {
+
+/** Nombre d'entrées du journal des défauts.*/
+constexpr std::size_t TAILLE_JOURNAL = 8;
+constexpr std::size_t TAILLE_TRAJET = 16;
+
+/** Nombre d'envois d'une trame avant d'abandonner.*/
+constexpr unsigned TENTATIVES = 5;
+
+/**
+ * Table du CRC-8, polynôme 0x07.
+ */
+struct TableCrc {
+    std::uint8_t valeurs[256];
+
+    TableCrc() {
+        for (unsigned n = 0; n < 256; n++) {
+            std::uint8_t crc = n;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+            }
+            valeurs[n] = crc;
+        }
+    }
+};
+
+const TableCrc tableCrc;
+
+std::uint16_t lit16(const std::uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+std::uint32_t lit32(const std::uint8_t *p) {
+    return lit16(p) | static_cast<std::uint32_t>(lit16(p + 2)) << 16;
+}
+
+/**
+ * Vérifie que la réponse commence par le code de la commande.
+ * @param reponse La réponse.
+ * @param code Le code.
+ */
+void verifieCode(const std::uint8_t *reponse, char code) {
+    if (reponse[0] != static_cast<std::uint8_t>(code)) {
+        throw ErreurLiaison(std::string("réponse inattendue à ") + code);
+    }
+}
+
+}
+
+std::uint8_t crc8(std::uint8_t crc, std::uint8_t octet) {
+    return tableCrc.valeurs[crc ^ octet];
+}
+
+Controleur::Controleur(const std::string &peripherique,
+        std::chrono::milliseconds delai) : delai(delai) {
+    struct termios t;
+
+    fd = open(peripherique.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        throw ErreurLiaison(peripherique + ": " + std::strerror(errno));
+    }
+    if (tcgetattr(fd, &t) == 0) {
+        cfmakeraw(&t);
+        cfsetispeed(&t, B9600);
+        cfsetospeed(&t, B9600);
+        t.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &t);
+    }
+    tcflush(fd, TCIOFLUSH);
+    if (pipe(reveil) != 0) {
+        close(fd);
+        throw ErreurLiaison(std::string("pipe: ") + std::strerror(errno));
+    }
+
+    // Une trame vide donne, quel que soit son numéro, le numéro attendu
+    // par le contrôleur:
+    auto sonde = std::make_shared<std::promise<void>>();
+    auto synchronisation = sonde->get_future();
+    {
+        Trame trame;
+        trame.sequence = 0;
+        trame.tentatives = 0;
+        Requete requete;
+        requete.longueurReponse = 0;
+        requete.succes = [sonde](const std::uint8_t *) {
+            sonde->set_value();
+        };
+        requete.echec = [sonde](std::exception_ptr e) {
+            sonde->set_exception(e);
+        };
+        trame.requetes.push_back(std::move(requete));
+        std::lock_guard<std::mutex> l(verrou);
+        emet(trame);
+        fenetre.push_back(std::move(trame));
+    }
+    fil = std::thread(&Controleur::boucle, this);
+    try {
+        synchronisation.get();
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> l(verrou);
+            fin = true;
+        }
+        reveille();
+        fil.join();
+        close(reveil[0]);
+        close(reveil[1]);
+        close(fd);
+        throw;
+    }
+}
+
+Controleur::~Controleur() {
+    {
+        std::lock_guard<std::mutex> l(verrou);
+        fin = true;
+    }
+    reveille();
+    fil.join();
+    echoueTout("liaison fermée");
+    close(reveil[0]);
+    close(reveil[1]);
+    close(fd);
+}
+
+void Controleur::reveille() {
+    std::uint8_t octet = 0;
+
+    if (write(reveil[1], &octet, 1) < 0) {
+        // Le fil est déjà réveillé.
+    }
+}
+
+template<typename T>
+std::future<T> Controleur::demande(std::vector<std::uint8_t> commande,
+        std::size_t longueurReponse,
+        std::function<T(const std::uint8_t *)> decode) {
+    auto promesse = std::make_shared<std::promise<T>>();
+    auto resultat = promesse->get_future();
+
+    if (commande.size() > TAILLE_TRAME
+            || longueurReponse > TAILLE_REPONSE) {
+        promesse->set_exception(std::make_exception_ptr(
+                ErreurLiaison("commande trop longue pour une trame")));
+        return resultat;
+    }
+
+    Requete requete;
+    requete.commande = std::move(commande);
+    requete.longueurReponse = longueurReponse;
+    requete.succes = [promesse, decode](const std::uint8_t *reponse) {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                decode(reponse);
+                promesse->set_value();
+            } else {
+                promesse->set_value(decode(reponse));
+            }
+        } catch (...) {
+            promesse->set_exception(std::current_exception());
+        }
+    };
+    requete.echec = [promesse](std::exception_ptr e) {
+        promesse->set_exception(e);
+    };
+    {
+        std::lock_guard<std::mutex> l(verrou);
+        if (fin) {
+            throw ErreurLiaison("liaison fermée");
+        }
+        attente.push_back(std::move(requete));
+    }
+    reveille();
+    return resultat;
+}
+
+std::future<std::vector<std::uint8_t>> Controleur::envoie(
+        std::vector<std::uint8_t> commande, std::size_t longueurReponse) {
+    return demande<std::vector<std::uint8_t>>(std::move(commande),
+            longueurReponse, [longueurReponse](const std::uint8_t *r) {
+                return std::vector<std::uint8_t>(r, r + longueurReponse);
+            });
+}
+
+std::future<void> Controleur::avance() {
+    return demande<void>({'A'}, 0, [](const std::uint8_t *) {});
+}
+
+std::future<void> Controleur::recule() {
+    return demande<void>({'R'}, 0, [](const std::uint8_t *) {});
+}
+
+std::future<void> Controleur::arrete() {
+    return demande<void>({'S'}, 0, [](const std::uint8_t *) {});
+}
+
+std::future<Position> Controleur::position() {
+    return demande<Position>({'P'}, 6, [](const std::uint8_t *r) {
+        verifieCode(r, 'P');
+        return Position {
+            static_cast<Etat>(r[1]),
+            static_cast<std::int32_t>(lit32(r + 2))
+        };
+    });
+}
+
+std::future<Freinage> Controleur::freinage() {
+    return demande<Freinage>({'F'}, 8, [](const std::uint8_t *r) {
+        verifieCode(r, 'F');
+        return Freinage {
+            static_cast<Etat>(r[1]),
+            static_cast<std::int32_t>(lit32(r + 2)),
+            lit16(r + 6)
+        };
+    });
+}
+
+std::future<Observation> Controleur::observateur() {
+    return demande<Observation>({'O'}, 9, [](const std::uint8_t *r) {
+        verifieCode(r, 'O');
+        return Observation {
+            static_cast<std::int32_t>(lit32(r + 1)),
+            static_cast<std::int16_t>(lit16(r + 5)),
+            static_cast<std::int16_t>(lit16(r + 7))
+        };
+    });
+}
+
+std::future<Calibration> Controleur::calibration() {
+    return demande<Calibration>({'K'}, 9, [](const std::uint8_t *r) {
+        verifieCode(r, 'K');
+        return Calibration {
+            r[1] != 0,
+            static_cast<std::int8_t>(r[2]),
+            lit16(r + 3),
+            lit16(r + 5),
+            lit16(r + 7)
+        };
+    });
+}
+
+std::future<Trajet> Controleur::trajet() {
+    return demande<Trajet>({'G'}, 3 + TAILLE_TRAJET * 4,
+            [](const std::uint8_t *r) {
+        verifieCode(r, 'G');
+        Trajet t;
+        t.lecture = r[1] != 0;
+        for (std::size_t n = 0; n < r[2] && n < TAILLE_TRAJET; n++) {
+            t.points.push_back(
+                    static_cast<std::int32_t>(lit32(r + 3 + n * 4)));
+        }
+        return t;
+    });
+}
+
+std::future<EnPosition> Controleur::enPosition(std::uint8_t delai) {
+    return demande<EnPosition>({'N', delai}, 3, [](const std::uint8_t *r) {
+        verifieCode(r, 'N');
+        return EnPosition { r[1], r[2] != 0 };
+    });
+}
+
+std::future<ReponseTable> Controleur::table(
+        const std::array<std::uint8_t, 16> &rapports,
+        const std::array<std::uint8_t, 4> &commutateurs) {
+    std::vector<std::uint8_t> commande {'U'};
+    commande.insert(commande.end(), rapports.begin(), rapports.end());
+    commande.insert(commande.end(), commutateurs.begin(),
+            commutateurs.end());
+    return demande<ReponseTable>(std::move(commande), 2,
+            [](const std::uint8_t *r) {
+                verifieCode(r, 'U');
+                return static_cast<ReponseTable>(r[1]);
+            });
+}
+
+std::future<bool> Controleur::lecture(std::uint8_t periode) {
+    return demande<bool>({'L', periode}, 2, [](const std::uint8_t *r) {
+        verifieCode(r, 'L');
+        return r[1] != 0;
+    });
+}
+
+std::future<void> Controleur::echantillons(
+        const std::array<Echantillon, ECHANTILLONS_BLOC> &bloc) {
+    std::vector<std::uint8_t> commande {'E'};
+    for (const auto &e : bloc) {
+        commande.push_back(e.rapport);
+        commande.push_back(e.commutateurs);
+    }
+    return demande<void>(std::move(commande), 0,
+            [](const std::uint8_t *) {});
+}
+
+std::future<BilanLecture> Controleur::bilanLecture() {
+    return demande<BilanLecture>({'B'}, 10, [](const std::uint8_t *r) {
+        verifieCode(r, 'B');
+        return BilanLecture {
+            lit32(r + 1),
+            lit16(r + 5),
+            lit16(r + 7),
+            r[9]
+        };
+    });
+}
+
+std::future<bool> Controleur::suivi(Suivi action) {
+    return demande<bool>({'M', static_cast<std::uint8_t>(action)}, 2,
+            [](const std::uint8_t *r) {
+                verifieCode(r, 'M');
+                return r[1] != 0;
+            });
+}
+
+std::future<Trajectoire> Controleur::trajectoire(
+        const std::vector<std::uint8_t> &morceau) {
+    if (morceau.size() > TAILLE_DONNEES) {
+        std::promise<Trajectoire> promesse;
+        promesse.set_exception(std::make_exception_ptr(
+                ErreurLiaison("morceau de trajectoire trop long")));
+        return promesse.get_future();
+    }
+    std::vector<std::uint8_t> commande {'D',
+            static_cast<std::uint8_t>(morceau.size())};
+    commande.insert(commande.end(), morceau.begin(), morceau.end());
+    return demande<Trajectoire>(std::move(commande), 3,
+            [](const std::uint8_t *r) {
+                verifieCode(r, 'D');
+                return Trajectoire { r[1] != 0, r[2] };
+            });
+}
+
+std::future<Statistiques> Controleur::statistiques() {
+    return demande<Statistiques>({'T'}, 31, [](const std::uint8_t *r) {
+        verifieCode(r, 'T');
+        Statistiques s;
+        s.microPasAvant = lit32(r + 1);
+        s.microPasArriere = lit32(r + 5);
+        s.dureeMouvements = lit32(r + 9);
+        s.mouvements = lit16(r + 13);
+        s.freinages = lit16(r + 15);
+        s.defauts = lit16(r + 17);
+        s.vitesseMax = lit16(r + 19);
+        s.dernierMicroPas = lit16(r + 21);
+        s.dureePrevue = lit32(r + 23);
+        s.dureeReelle = lit32(r + 27);
+        return s;
+    });
+}
+
+std::future<std::vector<EntreeJournal>> Controleur::journal() {
+    return demande<std::vector<EntreeJournal>>({'J'},
+            2 + TAILLE_JOURNAL * 12, [](const std::uint8_t *r) {
+        verifieCode(r, 'J');
+        std::vector<EntreeJournal> entrees;
+        for (std::size_t n = 0; n < r[1] && n < TAILLE_JOURNAL; n++) {
+            const std::uint8_t *e = r + 2 + n * 12;
+            EntreeJournal entree;
+            entree.temps = lit32(e);
+            entree.code = e[4];
+            entree.etat = e[5];
+            entree.pas = e[6];
+            entree.position = static_cast<std::int32_t>(lit32(e + 7));
+            entree.commande = e[11];
+            if (entree.code != 0xFF) {
+                entrees.push_back(entree);
+            }
+        }
+        return entrees;
+    });
+}
+
+std::future<Decroissance> Controleur::decroissance(Decroissance mode) {
+    return demande<Decroissance>({'C', static_cast<std::uint8_t>(mode)}, 2,
+            [](const std::uint8_t *r) {
+                verifieCode(r, 'C');
+                return static_cast<Decroissance>(r[1]);
+            });
+}
+
+std::future<BilanIndex> Controleur::capteurIndex(std::uint8_t options) {
+    return demande<BilanIndex>({'I', options}, 12, [](const std::uint8_t *r) {
+        verifieCode(r, 'I');
+        return BilanIndex {
+            r[1] != 0,
+            lit16(r + 2),
+            static_cast<std::int16_t>(lit16(r + 4)),
+            static_cast<std::int16_t>(lit16(r + 6)),
+            lit32(r + 8)
+        };
+    });
+}
+
+std::future<Profil> Controleur::profil(std::int16_t distance,
+        std::uint8_t croisiere, std::uint16_t acceleration) {
+    auto d = static_cast<std::uint16_t>(distance);
+    return demande<Profil>({'V', static_cast<std::uint8_t>(d),
+            static_cast<std::uint8_t>(d >> 8), croisiere,
+            static_cast<std::uint8_t>(acceleration),
+            static_cast<std::uint8_t>(acceleration >> 8)}, 3,
+            [](const std::uint8_t *r) {
+                verifieCode(r, 'V');
+                return Profil { r[1] != 0, r[2] != 0 };
+            });
+}
+
+std::future<bool> Controleur::profilChange(std::uint8_t croisiere,
+        std::uint16_t acceleration) {
+    return demande<bool>({'W', croisiere,
+            static_cast<std::uint8_t>(acceleration),
+            static_cast<std::uint8_t>(acceleration >> 8)}, 2,
+            [](const std::uint8_t *r) {
+                verifieCode(r, 'W');
+                return r[1] != 0;
+            });
+}
+
+unsigned long Controleur::reemissions() const {
+    std::lock_guard<std::mutex> l(verrou);
+    return nombreReemissions;
+}
+
+/**
+ * Fil de la liaison: envoie les commandes en attente, lit les réponses
+ * et surveille les délais.
+ */
+void Controleur::boucle() {
+    std::uint8_t tampon[256];
+    struct pollfd attentes[2];
+
+    attentes[0].fd = fd;
+    attentes[0].events = POLLIN;
+    attentes[1].fd = reveil[0];
+    attentes[1].events = POLLIN;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> l(verrou);
+            if (fin) {
+                return;
+            }
+            remplitFenetre();
+            verifieDelais();
+        }
+        if (poll(attentes, 2, 10) < 0 && errno != EINTR) {
+            std::lock_guard<std::mutex> l(verrou);
+            echoueTout(std::string("poll: ") + std::strerror(errno));
+            return;
+        }
+        if (attentes[1].revents & POLLIN) {
+            if (read(reveil[0], tampon, sizeof(tampon)) < 0) {
+                // Rien à faire: le réveil a eu lieu.
+            }
+        }
+        if (attentes[0].revents & POLLIN) {
+            ssize_t n = read(fd, tampon, sizeof(tampon));
+            if (n > 0) {
+                std::lock_guard<std::mutex> l(verrou);
+                recoit(tampon, n);
+            }
+        }
+    }
+}
+
+/**
+ * Envoie les commandes en attente, tant que la fenêtre n'est pas
+ * pleine. Chaque trame reçoit autant de commandes que possible.
+ */
+void Controleur::remplitFenetre() {
+    while (synchronise && fenetre.size() < FENETRE && !attente.empty()) {
+        Trame trame;
+        std::size_t commandes = 0, reponses = 0;
+
+        while (!attente.empty()
+                && commandes + attente.front().commande.size() <= TAILLE_TRAME
+                && reponses + attente.front().longueurReponse
+                        <= TAILLE_REPONSE) {
+            commandes += attente.front().commande.size();
+            reponses += attente.front().longueurReponse;
+            trame.requetes.push_back(std::move(attente.front()));
+            attente.pop_front();
+        }
+        trame.sequence = prochaine++;
+        trame.tentatives = 0;
+        emet(trame);
+        fenetre.push_back(std::move(trame));
+    }
+}
+
+/**
+ * Envoie une trame: SYNCHRONISATION, longueur, séquence, commandes, CRC.
+ * @param trame La trame.
+ */
+void Controleur::emet(Trame &trame) {
+    std::vector<std::uint8_t> octets;
+    std::uint8_t crc = 0;
+
+    octets.push_back(SYNCHRONISATION);
+    octets.push_back(0);
+    octets.push_back(trame.sequence);
+    for (const Requete &requete : trame.requetes) {
+        octets.insert(octets.end(),
+                requete.commande.begin(), requete.commande.end());
+    }
+    octets[1] = octets.size() - 3;
+    for (std::size_t n = 1; n < octets.size(); n++) {
+        crc = crc8(crc, octets[n]);
+    }
+    octets.push_back(crc);
+
+    std::size_t envoyes = 0;
+    while (envoyes < octets.size()) {
+        ssize_t n = write(fd, octets.data() + envoyes,
+                octets.size() - envoyes);
+        if (n < 0 && errno != EINTR && errno != EAGAIN) {
+            break;
+        }
+        if (n > 0) {
+            envoyes += n;
+        }
+    }
+    trame.envoi = std::chrono::steady_clock::now();
+    trame.tentatives++;
+}
+
+/**
+ * Découpe les octets reçus en trames de réponse: SYNCHRONISATION,
+ * longueur, acquittement, état, réponses, CRC.
+ * @param octets Les octets reçus.
+ * @param n Nombre d'octets.
+ */
+void Controleur::recoit(const std::uint8_t *octets, std::size_t n) {
+    recus.insert(recus.end(), octets, octets + n);
+
+    while (true) {
+        std::size_t debut = 0;
+        while (debut < recus.size() && recus[debut] != SYNCHRONISATION) {
+            debut++;
+        }
+        recus.erase(recus.begin(), recus.begin() + debut);
+        if (recus.size() < 2) {
+            return;
+        }
+        std::size_t longueur = recus[1];
+        if (longueur < 1 || longueur > 1 + TAILLE_REPONSE) {
+            recus.erase(recus.begin());
+            continue;
+        }
+        std::size_t total = 3 + longueur + 1;
+        if (recus.size() < total) {
+            return;
+        }
+        std::uint8_t crc = 0;
+        for (std::size_t i = 1; i < total - 1; i++) {
+            crc = crc8(crc, recus[i]);
+        }
+        if (crc != recus[total - 1]) {
+            recus.erase(recus.begin());
+            continue;
+        }
+        traite(recus[2], static_cast<EtatTrame>(recus[3]),
+                recus.data() + 4, longueur - 1);
+        recus.erase(recus.begin(), recus.begin() + total);
+    }
+}
+
+/**
+ * Traite une réponse du contrôleur. L'acquittement est cumulatif: les
+ * trames qui le précèdent ont toutes été exécutées.
+ * @param acquittement Numéro de la prochaine trame attendue.
+ * @param etat État de la trame reçue.
+ * @param donnees Réponses aux commandes.
+ * @param longueur Longueur des réponses.
+ */
+void Controleur::traite(std::uint8_t acquittement, EtatTrame etat,
+        const std::uint8_t *donnees, std::size_t longueur) {
+    if (!synchronise) {
+        if (fenetre.empty()) {
+            return;
+        }
+        synchronise = true;
+        prochaine = acquittement;
+        Trame sonde = std::move(fenetre.front());
+        fenetre.clear();
+        sonde.requetes.front().succes(nullptr);
+        return;
+    }
+    if (fenetre.empty()) {
+        return;
+    }
+
+    std::uint8_t acquittees = acquittement - fenetre.front().sequence;
+    if (acquittees > fenetre.size()) {
+        // Le contrôleur a redémarré, ou attend un autre numéro: les
+        // trames en attente sont renumérotées et réémises.
+        prochaine = acquittement;
+        for (Trame &trame : fenetre) {
+            trame.sequence = prochaine++;
+            emet(trame);
+            nombreReemissions++;
+        }
+        return;
+    }
+
+    // Les trames acquittées. Seule la dernière a sa réponse:
+    for (std::uint8_t n = 0; n < acquittees; n++) {
+        Trame trame = std::move(fenetre.front());
+        fenetre.pop_front();
+        bool derniere = n + 1 == acquittees;
+        bool reponse = derniere && (etat == EtatTrame::ACCEPTEE
+                || etat == EtatTrame::REPETEE);
+        std::size_t attendus = 0;
+        for (const Requete &requete : trame.requetes) {
+            attendus += requete.longueurReponse;
+        }
+        if (reponse && attendus != longueur) {
+            reponse = false;
+        }
+        const std::uint8_t *d = donnees;
+        for (Requete &requete : trame.requetes) {
+            if (requete.longueurReponse == 0) {
+                requete.succes(d);
+            } else if (reponse) {
+                requete.succes(d);
+                d += requete.longueurReponse;
+            } else {
+                requete.echec(std::make_exception_ptr(
+                        ErreurLiaison("réponse perdue")));
+            }
+        }
+    }
+
+    if (etat == EtatTrame::HORS_SEQUENCE || etat == EtatTrame::CORROMPUE) {
+        if (!fenetre.empty()) {
+            reprend();
+        }
+    }
+}
+
+/**
+ * Réémet les trames à partir de celle que le contrôleur attend, qui est
+ * la première de la fenêtre. Les
+ * réponses aux trames déjà envoyées derrière la trame perdue arrivent
+ * juste après, et ne doivent pas provoquer une nouvelle reprise.
+ */
+void Controleur::reprend() {
+    auto maintenant = std::chrono::steady_clock::now();
+
+    if (maintenant - derniereReprise < delai / 4) {
+        return;
+    }
+    derniereReprise = maintenant;
+    for (Trame &trame : fenetre) {
+        emet(trame);
+        nombreReemissions++;
+    }
+}
+
+/**
+ * Réémet la fenêtre si la plus ancienne trame n'a pas de réponse dans le
+ * délai, et abandonne après TENTATIVES envois.
+ */
+void Controleur::verifieDelais() {
+    if (fenetre.empty()) {
+        return;
+    }
+    Trame &ancienne = fenetre.front();
+    if (std::chrono::steady_clock::now() - ancienne.envoi < delai) {
+        return;
+    }
+    if (ancienne.tentatives >= TENTATIVES) {
+        echoueTout("le contrôleur ne répond pas");
+        return;
+    }
+    for (Trame &trame : fenetre) {
+        emet(trame);
+        nombreReemissions++;
+    }
+}
+
+/**
+ * Fait échouer toutes les commandes en attente.
+ * @param raison La raison.
+ */
+void Controleur::echoueTout(const std::string &raison) {
+    auto erreur = std::make_exception_ptr(ErreurLiaison(raison));
+
+    for (Trame &trame : fenetre) {
+        for (Requete &requete : trame.requetes) {
+            requete.echec(erreur);
+        }
+    }
+    fenetre.clear();
+    for (Requete &requete : attente) {
+        requete.echec(erreur);
+    }
+    attente.clear();
+}
+
+}
@@ -0,0 +1,392 @@
+/*
+ * Client du contrôleur de moteur pas à pas, pour l'hôte.
+ * Parle le protocole de trames de la liaison série (voir
+ * controleur-stepper.c): chaque appel rend un std::future, et les
+ * commandes sont envoyées en parallèle, jusqu'à FENETRE trames en
+ * attente d'acquittement. Quand la fenêtre est pleine, les commandes
+ * suivantes sont regroupées dans une même trame.
+ * Fonctionne avec le contrôleur réel, ou avec le simulateur.
+ */
+#ifndef CONTROLEUR_HPP
+#define CONTROLEUR_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace controleur {
+
+/** Constantes du protocole, comme dans controleur-stepper.c.*/
+constexpr std::uint8_t SYNCHRONISATION = 0xA5;
+constexpr std::size_t TAILLE_TRAME = 32;
+constexpr std::size_t TAILLE_REPONSE = 128;
+constexpr std::size_t FENETRE = 3;
+constexpr std::size_t TAILLE_DONNEES = 20;
+constexpr std::size_t ECHANTILLONS_BLOC = 8;
+
+/** États d'une trame, en tête de la réponse.*/
+enum class EtatTrame : std::uint8_t {
+    ACCEPTEE = 0,
+    REPETEE = 1,
+    HORS_SEQUENCE = 2,
+    CORROMPUE = 3
+};
+
+/** États de la machine du contrôleur.*/
+enum class Etat : std::uint8_t {
+    ARRET,
+    MARCHE_AVANT,
+    FREIN_AVANT,
+    MARCHE_ARRIERE,
+    FREIN_ARRIERE,
+    DEFAUT,
+    LECTURE,
+    SUIVI
+};
+
+/** Modes de décroissance du courant, pour COMMANDE_DECROISSANCE.*/
+enum class Decroissance : std::uint8_t {
+    LENTE = 0,
+    RAPIDE = 1,
+    MIXTE = 2,
+    AUCUNE = 3
+};
+
+/** Réponses à COMMANDE_TABLE.*/
+enum class ReponseTable : std::uint8_t {
+    /** Les tables seront en service au prochain pas entier.*/
+    ACCEPTEE = 0,
+    /** Les tables ont une valeur hors limites.*/
+    INVALIDE = 1,
+    /** Les tables précédentes ne sont pas encore en service.*/
+    OCCUPEE = 2
+};
+
+/** Arguments de COMMANDE_SUIVI.*/
+enum class Suivi : std::uint8_t {
+    TERMINE = 0,
+    PREPARE = 1,
+    DEMARRE = 2
+};
+
+/** Échantillon du mode lecture.*/
+struct Echantillon {
+    /** Rapport cyclique, de 0 à 33.*/
+    std::uint8_t rapport;
+    /** Position des commutateurs.*/
+    std::uint8_t commutateurs;
+};
+
+/** Réponse à COMMANDE_BILAN_LECTURE.*/
+struct BilanLecture {
+    std::uint32_t joues;
+    /** Interruptions où le tampon était vide.*/
+    std::uint16_t tamponsVides;
+    std::uint16_t blocsRefuses;
+    /** Place libre dans le tampon, en échantillons.*/
+    std::uint8_t libre;
+};
+
+/** Réponse à COMMANDE_TRAJECTOIRE.*/
+struct Trajectoire {
+    bool accepte;
+    /** Place libre dans la file du mode suivi, en pas.*/
+    std::uint8_t libre;
+};
+
+/** Réponse à COMMANDE_POSITION.*/
+struct Position {
+    Etat etat;
+    std::int32_t position;
+};
+
+/** Réponse à COMMANDE_FREINAGE: où et quand le moteur s'arrêterait.*/
+struct Freinage {
+    Etat etat;
+    std::int32_t position;
+    /** Durée du freinage, en ms.*/
+    std::uint16_t duree;
+};
+
+/** Réponse à COMMANDE_OBSERVATEUR.*/
+struct Observation {
+    /** Position estimée du rotor, en micro-pas.*/
+    std::int32_t position;
+    /** Vitesse estimée, en 1/16 de micro-pas/s.*/
+    std::int16_t vitesse;
+    /** Dernier résidu de l'observateur, en 1/256 de micro-pas.*/
+    std::int16_t residu;
+};
+
+/** Réponse à COMMANDE_CALIBRATION.*/
+struct Calibration {
+    /** La correction a été mesurée à ce démarrage, et non lue dans
+     * l'EEPROM.*/
+    bool mesuree;
+    /** Correction ajoutée aux rapports cycliques des tables.*/
+    std::int8_t correction;
+    /** Sommes des conversions du shunt: pont 1 au rapport 16, puis 24,
+     * et pont 2 au rapport 16.*/
+    std::uint16_t pont1;
+    std::uint16_t pont1Ecart;
+    std::uint16_t pont2;
+};
+
+/** Réponse à COMMANDE_TRAJET.*/
+struct Trajet {
+    /** Le trajet est en train d'être rejoué.*/
+    bool lecture;
+    /** Position de chaque point de passage, en micro-pas.*/
+    std::vector<std::int32_t> points;
+};
+
+/** Réponse à COMMANDE_EN_POSITION.*/
+struct EnPosition {
+    /** Délai entre la fin d'un freinage et la sortie, en interruptions
+     * du temporisateur 2 (4,752ms).*/
+    std::uint8_t delai;
+    /** État de la sortie «en position».*/
+    bool sortie;
+};
+
+/** Réponse à COMMANDE_PROFIL.*/
+struct Profil {
+    /** Le déplacement a démarré.*/
+    bool enCours;
+    /** Son plan était en mémoire dans le contrôleur.*/
+    bool planConnu;
+};
+
+/** Options de COMMANDE_INDEX.*/
+constexpr std::uint8_t INDEX_CORRECTION = 0x01;
+constexpr std::uint8_t INDEX_REFERENCE = 0x02;
+
+/** Réponse à COMMANDE_INDEX.*/
+struct BilanIndex {
+    bool referenceValide;
+    std::uint16_t tours;
+    std::int16_t derive;
+    std::int16_t corrections;
+    std::uint32_t temps;
+};
+
+/** Réponse à COMMANDE_STATISTIQUES.*/
+struct Statistiques {
+    std::uint32_t microPasAvant;
+    std::uint32_t microPasArriere;
+    std::uint32_t dureeMouvements;
+    std::uint16_t mouvements;
+    std::uint16_t freinages;
+    std::uint16_t defauts;
+    std::uint16_t vitesseMax;
+    std::uint16_t dernierMicroPas;
+    std::uint32_t dureePrevue;
+    std::uint32_t dureeReelle;
+};
+
+/** Entrée de la réponse à COMMANDE_JOURNAL.*/
+struct EntreeJournal {
+    std::uint32_t temps;
+    std::uint8_t code;
+    std::uint8_t etat;
+    std::uint8_t pas;
+    std::int32_t position;
+    std::uint8_t commande;
+};
+
+/** Erreur de communication avec le contrôleur.*/
+class ErreurLiaison : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * Calcule le CRC-8 (polynôme 0x07, valeur initiale 0) utilisé par les
+ * trames.
+ * @param crc CRC des octets précédents.
+ * @param octet L'octet.
+ * @return Le nouveau CRC.
+ */
+std::uint8_t crc8(std::uint8_t crc, std::uint8_t octet);
+
+/**
+ * Connexion à un contrôleur.
+ * Un fil d'exécution envoie les trames, lit les réponses, et réémet les
+ * trames perdues. Les appels peuvent venir de plusieurs fils.
+ */
+class Controleur {
+public:
+    /**
+     * Ouvre la liaison série et synchronise les numéros de trame.
+     * @param peripherique Port série ou pseudo-terminal du simulateur.
+     * @param delai Temps d'attente d'une réponse avant de réémettre.
+     */
+    explicit Controleur(const std::string &peripherique,
+            std::chrono::milliseconds delai = std::chrono::milliseconds(500));
+    ~Controleur();
+
+    Controleur(const Controleur &) = delete;
+    Controleur &operator=(const Controleur &) = delete;
+
+    /**
+     * Envoie une commande brute.
+     * @param commande Code de la commande, suivi de ses données.
+     * @param longueurReponse Longueur de la réponse attendue.
+     * @return La réponse.
+     */
+    std::future<std::vector<std::uint8_t>> envoie(
+            std::vector<std::uint8_t> commande,
+            std::size_t longueurReponse);
+
+    /** Démarre en marche avant, ou freine si le moteur recule.*/
+    std::future<void> avance();
+    /** Démarre en marche arrière, ou freine si le moteur avance.*/
+    std::future<void> recule();
+    /** Freine jusqu'au pas entier suivant.*/
+    std::future<void> arrete();
+    /** Lit l'état de la machine et la position absolue.*/
+    std::future<Position> position();
+    /** Prédit la position d'arrêt et la durée d'un freinage immédiat.*/
+    std::future<Freinage> freinage();
+    /** Lit la position et la vitesse estimées du rotor.*/
+    std::future<Observation> observateur();
+    /** Lit la calibration du courant faite au démarrage.*/
+    std::future<Calibration> calibration();
+    /** Lit le trajet appris avec les boutons.*/
+    std::future<Trajet> trajet();
+    /**
+     * Règle le délai de la sortie «en position», et lit son état.
+     * @param delai En interruptions du temporisateur 2 (4,752ms).
+     */
+    std::future<EnPosition> enPosition(std::uint8_t delai);
+    /**
+     * Envoie de nouvelles tables de commutation.
+     * @param rapports Les 16 rapports cycliques, de 0 à 33.
+     * @param commutateurs Les 4 positions des commutateurs.
+     */
+    std::future<ReponseTable> table(
+            const std::array<std::uint8_t, 16> &rapports,
+            const std::array<std::uint8_t, 4> &commutateurs);
+    /**
+     * Démarre le mode lecture, si le moteur est à l'arrêt.
+     * @param periode Période des échantillons, en interruptions du
+     * temporisateur 2 (4,752ms); 0 arrête le moteur.
+     * @return Le mode lecture est en cours.
+     */
+    std::future<bool> lecture(std::uint8_t periode);
+    /**
+     * Ajoute un bloc d'échantillons au tampon du mode lecture. Le
+     * contrôleur ne répond pas: un bloc refusé n'apparaît que dans le
+     * bilan.
+     */
+    std::future<void> echantillons(
+            const std::array<Echantillon, ECHANTILLONS_BLOC> &bloc);
+    /** Lit le bilan du mode lecture.*/
+    std::future<BilanLecture> bilanLecture();
+    /**
+     * Commande le mode suivi.
+     * @return Le mode suivi est en cours.
+     */
+    std::future<bool> suivi(Suivi action);
+    /**
+     * Envoie un morceau de trajectoire pour le mode suivi.
+     * @param morceau Au plus TAILLE_DONNEES octets de pas codés, comme
+     * l'explique COMMANDE_TRAJECTOIRE dans controleur-stepper.c.
+     */
+    std::future<Trajectoire> trajectoire(
+            const std::vector<std::uint8_t> &morceau);
+    /** Lit les statistiques de vie et le bilan du dernier mouvement.*/
+    std::future<Statistiques> statistiques();
+    /** Lit le journal des défauts.*/
+    std::future<std::vector<EntreeJournal>> journal();
+    /**
+     * Choisit le mode de décroissance du courant.
+     * @return Le mode en service.
+     */
+    std::future<Decroissance> decroissance(Decroissance mode);
+    /**
+     * Configure le capteur d'index, et lit son bilan.
+     * @param options INDEX_CORRECTION, INDEX_REFERENCE.
+     */
+    std::future<BilanIndex> capteurIndex(std::uint8_t options);
+    /**
+     * Démarre un déplacement profilé.
+     * @param distance En micro-pas, négative en marche arrière.
+     * @param croisiere Intervalle entre deux pas à la vitesse de
+     * croisière, en interruptions du temporisateur 2 (1 à 127).
+     * @param acceleration En micro-pas/s².
+     */
+    std::future<Profil> profil(std::int16_t distance, std::uint8_t croisiere,
+            std::uint16_t acceleration);
+    /**
+     * Change la vitesse de croisière et l'accélération du déplacement
+     * profilé en cours, sans l'arrêter.
+     * @return Le changement est accepté.
+     */
+    std::future<bool> profilChange(std::uint8_t croisiere,
+            std::uint16_t acceleration);
+
+    /** Nombre de trames réémises depuis l'ouverture.*/
+    unsigned long reemissions() const;
+
+private:
+    /** Commande en attente d'envoi ou de réponse.*/
+    struct Requete {
+        std::vector<std::uint8_t> commande;
+        std::size_t longueurReponse;
+        std::function<void(const std::uint8_t *)> succes;
+        std::function<void(std::exception_ptr)> echec;
+    };
+
+    /** Trame envoyée, en attente d'acquittement.*/
+    struct Trame {
+        std::uint8_t sequence;
+        std::vector<Requete> requetes;
+        std::chrono::steady_clock::time_point envoi;
+        unsigned tentatives;
+    };
+
+    template<typename T>
+    std::future<T> demande(std::vector<std::uint8_t> commande,
+            std::size_t longueurReponse,
+            std::function<T(const std::uint8_t *)> decode);
+
+    void boucle();
+    void remplitFenetre();
+    void emet(Trame &trame);
+    void recoit(const std::uint8_t *octets, std::size_t n);
+    void traite(std::uint8_t acquittement, EtatTrame etat,
+            const std::uint8_t *donnees, std::size_t longueur);
+    void reprend();
+    void verifieDelais();
+    void echoueTout(const std::string &raison);
+    void reveille();
+
+    int fd;
+    int reveil[2];
+    std::chrono::milliseconds delai;
+    std::thread fil;
+    bool fin = false;
+
+    mutable std::mutex verrou;
+    std::deque<Requete> attente;
+    std::deque<Trame> fenetre;
+    std::uint8_t prochaine = 0;
+    bool synchronise = false;
+    unsigned long nombreReemissions = 0;
+    std::chrono::steady_clock::time_point derniereReprise;
+
+    std::vector<std::uint8_t> recus;
+};
+
+}
+
+#endif
@@ -0,0 +1,167 @@
+#!/bin/sh
+#
+# Mesure les performances du contrôleur sur le simulateur, et les
+# compare à la référence perf/reference.txt.
+#
+#   perf.sh verifie     Échoue si une mesure dépasse la référence de
+#                       plus de SEUIL pour cent (5 par défaut).
+#   perf.sh reference   Remplace la référence par les mesures actuelles.
+#   perf.sh variantes   Compare le chemin des pas compact et sa variante
+#                       COMMUTATION_RAPIDE, sans référence.
+#
+# Le simulateur instrumenté par gcov joue perf/scenario.txt, sans
+# pseudo-terminal ni temps réel: les mesures sont reproductibles. Ce
+# ne sont pas celles du PIC. Les durées modele_* sont en cycles du
+# modèle du simulateur, qui ne compte que les accès aux registres, les
+# appels et l'entrée et la sortie des interruptions; les tailles
+# hote_* sont celles du contrôleur compilé pour l'hôte. Elles suivent
+# les coûts du PIC à peu près, et servent à voir qu'ils changent.
+#   modele_hp_maximum
+#                   Pire durée de interruptionsHP().
+#   modele_hp_moyen Durée moyenne de interruptionsHP() par pas.
+#   modele_tictac_retard_maximum
+#                   Pire retard d'une TICTAC dû au programme principal.
+#   modele_mouvement_p99
+#                   Délai entre la fin d'une trame de démarrage et le
+#                   premier pas.
+#   lignes_par_pas  Lignes de C exécutées par pas dans le chemin des
+#                   interruptions de haute priorité (FONCTIONS_PAS).
+#                   Contrairement au modèle de cycles, elle voit tout le
+#                   code ajouté à machine(). Une macro y compte pour une
+#                   seule ligne: la variante rapide y paraît plus
+#                   courte qu'elle ne l'est.
+#   instructions_hp_moyen, instructions_hp_maximum
+#                   Instructions de l'hôte exécutées par le contrôleur,
+#                   compilé sans optimisation, dans une interruption de
+#                   haute priorité, en moyenne et au plus (voir
+#                   COMPTE_INSTRUCTIONS dans simulateur.c). Elles
+#                   comptent les calculs et les branchements que le
+#                   modèle de cycles ne voit pas, macros comprises.
+#   instructions_crc_octet
+#                   Instructions de crc8(), par octet des trames.
+#   hote_flash, hote_ram
+#                   Taille du code et des données.
+# La vitesse de pas maximum est affichée pour information: le moteur
+# fait au plus un pas par interruption du temporisateur 2, donc
+# FCY / tmr2_periode pas par seconde, tant que modele_hp_maximum tient
+# dans la période. Les tailles dépendent du compilateur de l'hôte:
+# après en avoir changé, il faut refaire la référence.
+#
+
+set -e
+cd "$(dirname "$0")"
+
+SEUIL=${SEUIL:-5}
+CONSTRUCTION=perf/construction
+MESURES=perf/mesures.txt
+REFERENCE=perf/reference.txt
+RAPIDE=perf/construction-rapide
+MESURES_RAPIDE=perf/mesures-rapide.txt
+FONCTIONS_PAS="interruptionsHP machine commutationDeplacement \
+commutationStationnement commutationEchantillon commutationCoupure \
+commutationRetablissement suiviSuivant tictacArrete tictacDemarre \
+journalDefaut"
+
+# Mesure la construction $1, avec la taille de l'objet $2, dans $3.
+mesure() {
+    rm -f $1/*.gcda
+    $1/simulateur -s perf/scenario.txt -m $1/simulateur.txt
+    $1/instructions -s perf/scenario.txt -m $1/instructions.txt
+
+    # Lignes exécutées dans les fonctions du chemin des pas:
+    lignes=$(gcov -t -o $1 programme.c 2>/dev/null | awk -v \
+            fonctions="$FONCTIONS_PAS" '
+        BEGIN {
+            n = split(fonctions, f, " ");
+            for (i = 1; i <= n; i++) pas[f[i]] = 1;
+        }
+        {
+            compte = $1; sub(/:$/, "", compte);
+            source = $0; sub(/^[^:]*:[^:]*:/, "", source);
+        }
+        source ~ /^[a-z][a-zA-Z ]* \**[a-zA-Z]+\([^;]*$/ {
+            fonction = source;
+            sub(/\(.*/, "", fonction);
+            sub(/.* \**/, "", fonction);
+        }
+        fonction in pas && compte ~ /^[0-9]+$/ { total += compte }
+        source == "}" { fonction = "" }
+        END { print total + 0 }')
+
+    awk -v lignes="$lignes" '
+        { m[$1] = $2 }
+        END {
+            print "modele_hp_maximum", m["hp_maximum"];
+            print "modele_hp_moyen", m["hp_moyen"];
+            print "modele_tictac_retard_maximum", \
+                m["tictac_retard_maximum"];
+            printf "lignes_par_pas %.1f\n", lignes / m["tictac_appels"];
+            print "modele_mouvement_p99", m["mouvement_p99"];
+        }' $1/simulateur.txt > $3
+    awk '
+        { m[$1] = $2 }
+        END {
+            print "instructions_hp_moyen", m["hp_instructions_moyen"];
+            print "instructions_hp_maximum", m["hp_instructions_maximum"];
+            print "instructions_crc_octet", m["crc_instructions_octet"];
+        }' $1/instructions.txt >> $3
+    size $2 | awk 'NR == 2 {
+        print "hote_flash", $1;
+        print "hote_ram", $2 + $3;
+    }' >> $3
+}
+
+if [ "$1" = variantes ]; then
+    mesure $CONSTRUCTION programme.o $MESURES
+    mesure $RAPIDE $RAPIDE/taille.o $MESURES_RAPIDE
+    printf "%-30s %10s %10s\n" "" compact rapide
+    awk '
+        FNR == NR { compact[$1] = $2; next }
+        {
+            r = compact[$1];
+            ecart = r > 0 ? ($2 - r) * 100 / r : 0;
+            printf "%-30s %10s %10s %+7.1f%%\n", $1, r, $2, ecart;
+        }' $MESURES $MESURES_RAPIDE
+    exit 0
+fi
+
+mesure $CONSTRUCTION programme.o $MESURES
+
+awk '
+    { m[$1] = $2 }
+    END {
+        printf "Vitesse de pas maximum: %.1f pas/s, un par période du\n", \
+            250000 / m["tmr2_periode"];
+        printf "temporisateur 2 (%d cycles, dont %d%% au plus dans\n", \
+            m["tmr2_periode"], 100 * m["hp_maximum"] / m["tmr2_periode"];
+        print "interruptionsHP)";
+    }' $CONSTRUCTION/simulateur.txt
+
+case "$1" in
+    reference)
+        cp $MESURES $REFERENCE
+        cat $REFERENCE
+        ;;
+    verifie)
+        awk -v seuil="$SEUIL" '
+            FNR == NR { reference[$1] = $2; next }
+            {
+                r = reference[$1];
+                ecart = r > 0 ? ($2 - r) * 100 / r : 0;
+                etat = ecart > seuil ? "RÉGRESSION" : "ok";
+                printf "%-30s %10s %10s %+7.1f%%  %s\n", \
+                    $1, r, $2, ecart, etat;
+                if (ecart > seuil) echec = 1;
+            }
+            END {
+                if (echec) {
+                    print "Régression de plus de " seuil "%: voir ci-dessus.";
+                    exit 1;
+                }
+            }' $REFERENCE $MESURES
+        ;;
+    *)
+        echo "Usage: $0 verifie|reference|variantes" >&2
+        exit 1
+        ;;
+esac
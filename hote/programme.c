@@ -0,0 +1,24 @@
+/*
+ * Le programme du contrôleur, compilé pour le simulateur.
+ * Sa fonction main() devient programme(), que le simulateur appelle
+ * après avoir préparé le microcontrôleur simulé.
+ * Le contrôleur n'utilise que des entiers de taille fixe (<stdint.h>):
+ * ses variables ont la même taille que sur le PIC, et débordent de la
+ * même façon. Seuls les calculs intermédiaires se font en int de 32
+ * bits au lieu de 16: les expressions qui peuvent déborder en 16 bits
+ * doivent être écrites avec des conversions explicites. La disposition
+ * des structures dans l'EEPROM simulée diffère de celle du PIC, qui ne
+ * les aligne pas.
+ * Le simulateur fournit le capteur d'index, le shunt pour la
+ * calibration du courant, et les boutons de l'apprentissage; la sortie
+ * «en position» est lue par COMMANDE_EN_POSITION.
+ */
+
+#define CAPTEUR_INDEX
+#define CALIBRATION_COURANT
+#define APPRENTISSAGE
+#define SORTIE_EN_POSITION LATCbits.LATC2
+#define DIRECTION_EN_POSITION TRISCbits.RC2
+#define main programme
+
+#include "../controleur-stepper.c"
@@ -0,0 +1,1551 @@
+/*
+ * Simule le PIC18F25K22 pour exécuter le contrôleur sur l'hôte.
+ * Le programme du contrôleur est compilé tel quel (voir programme.c),
+ * avec un <xc.h> où chaque accès à un registre fait avancer le temps
+ * simulé (voir xc.h), comme chaque appel de fonction (voir
+ * __cyg_profile_func_enter). Le simulateur fait évoluer les
+ * temporisateurs 0, 2 et 4, le EUSART2, l'EEPROM et le convertisseur
+ * A/D sur le shunt (voir adcConvertit), suit le rotor pour le capteur
+ * d'index (voir rotorSuit), et appelle les interruptions.
+ * La liaison série du contrôleur est un pseudo-terminal, que les
+ * clients ouvrent comme un port série.
+ *
+ * Usage: simulateur [-l lien] [-e eeprom] [-x facteur] [-m mesures]
+ *                   [-s scenario]
+ *   -l lien    Crée un lien symbolique vers le pseudo-terminal.
+ *   -e eeprom  Charge l'EEPROM depuis ce fichier, et l'y sauvegarde.
+ *   -x facteur Vitesse du temps simulé par rapport au temps réel;
+ *              0 pour aller aussi vite que possible. Par défaut 1.
+ *   -m mesures Écrit dans ce fichier, en terminant, la durée des
+ *              interruptions, le retard des TICTAC et le délai entre
+ *              une commande et le premier pas (voir mesuresEcrit).
+ *              Compilé avec COMPTE_INSTRUCTIONS, le simulateur y ajoute
+ *              les instructions exécutées par le contrôleur (voir
+ *              instructionCompte).
+ *   -s scenario Joue les trames du scénario au lieu d'ouvrir un
+ *              pseudo-terminal, aussi vite que possible, puis termine
+ *              (voir scenarioLit). Les mesures sont alors
+ *              reproductibles, et les réponses attendues par le
+ *              scénario sont vérifiées.
+ * SIGUSR1 et SIGUSR2 simulent les boutons INT2 (avance) et INT1
+ * (recule), et SIGHUP un décrochage du rotor, qui perd 32 micro-pas.
+ * SIGRTMIN et SIGRTMIN+1 appuient brièvement sur les boutons de
+ * l'apprentissage RC0 (mémorise) et RC1 (rejoue), et SIGRTMIN+2
+ * maintient RC0 assez longtemps pour effacer le trajet.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "xc.h"
+
+/**
+ * Fréquence des cycles d'instruction: Fosc / 4, avec l'oscillateur
+ * interne à 1MHz.
+ */
+#define FCY 250000
+
+/**
+ * Cycles d'instruction pour entrer dans une interruption et sauvegarder
+ * le contexte, puis pour le restaurer et en sortir.
+ */
+#define CYCLES_ENTREE 12
+#define CYCLES_SORTIE 10
+
+/**
+ * Cycles d'instruction d'un CALL et d'un RETURN: XC8 ne développe pas
+ * les fonctions sur place.
+ */
+#define CYCLES_CALL 2
+#define CYCLES_RETURN 2
+
+/**
+ * Cycles entre deux synchronisations avec le temps réel et le
+ * pseudo-terminal: 1ms.
+ */
+#define CYCLES_RYTHME (FCY / 1000)
+
+/**
+ * Durée d'une écriture dans l'EEPROM, en cycles: 4ms.
+ */
+#define CYCLES_EEPROM (4 * FCY / 1000)
+
+/**
+ * Durée d'une conversion A/D, en cycles: 2 TAD d'acquisition et 11 de
+ * conversion, à 2us.
+ */
+#define CYCLES_CONVERSION 7
+
+/**
+ * Conversion A/D du shunt par compte du rapport cyclique d'une bobine.
+ */
+#define ADC_PAR_RAPPORT 12
+
+/**
+ * Comptes du PWM perdus par le pont de P3B, pour le temps mort et la
+ * tolérance des composants: c'est ce que corrige la calibration du
+ * contrôleur.
+ */
+#define DESEQUILIBRE_P3B 3
+
+/**
+ * Durées d'un appui bref et d'un appui long sur un bouton de
+ * l'apprentissage, en cycles: 100ms et 3s.
+ */
+#define CYCLES_APPUI (FCY / 10)
+#define CYCLES_APPUI_LONG (3 * FCY)
+
+/**
+ * Taille des files d'octets entre le pseudo-terminal et le EUSART2.
+ */
+#define TAILLE_FILE 4096
+
+/**
+ * Nombre maximum de délais commande - mouvement mémorisés.
+ */
+#define TAILLE_LATENCES 4096
+
+void programme(void);
+void interruptionsHP(void);
+void interruptionsBP(void);
+static void termine(void);
+
+/*
+ * Registres.
+ */
+volatile unsigned char CCPR3L_r, PR2_r = 0xFF, TMR2_r, TMR0L_r, TMR0H_r;
+volatile unsigned char PR4_r = 0xFF, TMR4_r;
+volatile unsigned char ANSELA_r = 0xFF, ANSELC_r = 0xFF, TRISA_r = 0xFF;
+volatile unsigned char LATA_r, EEADR_r, EEDATA_r, EECON2_r;
+volatile unsigned char SPBRG2_r, SPBRGH2_r, RCREG2_r, TXREG2_r;
+volatile unsigned char ADRESH_r, ADRESL_r, TMR1L_r, TMR1H_r;
+volatile unsigned char CCPR1L_r, CCPR1H_r;
+volatile PORTA_t PORTA_r;
+volatile PORTB_t PORTB_r;
+volatile PORTC_t PORTC_r;
+volatile LATB_t LATB_r;
+volatile LATC_t LATC_r;
+volatile TRISB_t TRISB_r = { 0xFF };
+volatile TRISC_t TRISC_r = { 0xFF };
+volatile ANSELB_t ANSELB_r = { 0x3F };
+volatile WPUB_t WPUB_r = { 0xFF };
+volatile IOCB_t IOCB_r = { 0xF0 };
+volatile INTCON_t INTCON_r;
+volatile INTCON2_t INTCON2_r = { 0xFF };
+volatile INTCON3_t INTCON3_r = { 0xC0 };
+volatile PIR1_t PIR1_r;
+volatile PIE1_t PIE1_r;
+volatile IPR1_t IPR1_r = { 0xFF };
+volatile PIR2_t PIR2_r;
+volatile PIR3_t PIR3_r;
+volatile PIE3_t PIE3_r;
+volatile IPR3_t IPR3_r = { 0xFF };
+volatile PIR5_t PIR5_r;
+volatile PIE5_t PIE5_r;
+volatile IPR5_t IPR5_r = { 0x07 };
+volatile RCON_t RCON_r = { 0x1F };
+volatile T0CON_t T0CON_r = { 0xFF };
+volatile T1CON_t T1CON_r;
+volatile T2CON_t T2CON_r;
+volatile T4CON_t T4CON_r;
+volatile CCP1CON_t CCP1CON_r;
+volatile CCP3CON_t CCP3CON_r;
+volatile CCPTMRS0_t CCPTMRS0_r;
+volatile CCP3AS_t CCP3AS_r;
+volatile PWM3CON_t PWM3CON_r;
+volatile PSTR3CON_t PSTR3CON_r = { 0x01 };
+volatile VREFCON0_t VREFCON0_r;
+volatile VREFCON1_t VREFCON1_r;
+volatile VREFCON2_t VREFCON2_r;
+volatile CM1CON0_t CM1CON0_r;
+volatile CM2CON0_t CM2CON0_r;
+volatile CM2CON1_t CM2CON1_r;
+volatile EECON1_t EECON1_r;
+volatile TXSTA2_t TXSTA2_r = { 0x02 };
+volatile RCSTA2_t RCSTA2_r;
+volatile BAUDCON2_t BAUDCON2_r;
+volatile ADCON0_t ADCON0_r;
+volatile ADCON1_t ADCON1_r;
+volatile ADCON2_t ADCON2_r;
+volatile OSCCON_t OSCCON_r;
+
+/**
+ * Cycles d'instruction écoulés depuis le démarrage.
+ */
+static unsigned long long cycle = 0;
+
+/**
+ * Niveau d'interruption en cours: 0 pour le programme principal, 1 pour
+ * la basse priorité, 2 pour la haute priorité.
+ */
+static unsigned char niveau = 0;
+
+/**
+ * Accès en attente de traitement.
+ */
+static unsigned char rcregLu = 0;
+static unsigned char txregEcrit = 0;
+static unsigned char tmr0Vu = 0;
+static unsigned char tmr0Valeur;
+
+/**
+ * Temporisateur 0: cycles de pré-diviseur accumulés, et cycles de
+ * suspension après une écriture.
+ */
+static unsigned char tmr0Prediviseur = 0;
+static unsigned char tmr0Suspendu = 0;
+
+/**
+ * Temporisateur 2: cycles de pré-diviseur accumulés, et périodes
+ * comptées par le post-diviseur.
+ */
+static unsigned char tmr2Prediviseur = 0;
+static unsigned char tmr2Postdiviseur = 0;
+
+/**
+ * Temporisateur 4, de la même manière.
+ */
+static unsigned char tmr4Prediviseur = 0;
+static unsigned char tmr4Postdiviseur = 0;
+
+/**
+ * EUSART2: files vers et depuis le pseudo-terminal, FIFO de réception
+ * de 2 octets, tampon et registre à décalage d'émission.
+ */
+static unsigned char entree[TAILLE_FILE];
+static unsigned int entreeDebut = 0, entreeFin = 0;
+static unsigned char sortie[TAILLE_FILE];
+static unsigned int sortieFin = 0;
+static unsigned char rxFifo[2];
+static unsigned char rxNombre = 0;
+static unsigned long long rxFin = 0;
+static unsigned char rxOccupe = 0;
+static unsigned char rxOctet;
+static unsigned char txTampon;
+static unsigned char txPlein = 0;
+static unsigned char txOctet;
+static unsigned char txOccupe = 0;
+static unsigned long long txFin = 0;
+
+/**
+ * EEPROM.
+ */
+static unsigned char eeprom[256];
+static const char *eepromFichier = 0;
+static unsigned char eepromEcriture = 0;
+static unsigned char eepromAdresse;
+static unsigned char eepromDonnee;
+static unsigned long long eepromFin;
+
+/**
+ * Convertisseur A/D.
+ */
+static unsigned char adcConversion = 0;
+static unsigned long long adcFin;
+
+/**
+ * Pseudo-terminal et rythme.
+ */
+static int maitre = -1;
+static const char *lien = 0;
+static double facteur = 1;
+static struct timespec debut;
+static unsigned long long prochainRythme = CYCLES_RYTHME;
+
+/**
+ * Actions d'une ligne du scénario (voir scenarioLit).
+ */
+enum Action {
+    TRAME,
+    GLISSE,
+    SURINTENSITE,
+    ROTOR,
+    FIN
+};
+
+/**
+ * Scénario: prochaine action, sa ligne, et le cycle où la faire; pour
+ * une trame, ses commandes, et pour ROTOR, la position attendue. Une
+ * trame répétée est renvoyée tous les scenarioPas cycles jusqu'au cycle
+ * scenarioRepetition.
+ */
+static FILE *scenario = 0;
+static enum Action scenarioAction = TRAME;
+static unsigned int scenarioNumero = 0;
+static long scenarioRotor = 0;
+static unsigned char scenarioCommandes[255];
+static unsigned int scenarioNombre = 0;
+static unsigned char scenarioTrame[3 + 255 + 1];
+static unsigned int scenarioLongueur = 0;
+static unsigned char scenarioSequence = 0;
+static unsigned long long scenarioCycle = 0;
+static unsigned long long scenarioRepetition = 0;
+static unsigned long long scenarioPas = 0;
+
+/**
+ * Ligne du scénario lue d'avance, et numéro de la dernière ligne lue.
+ */
+static char scenarioSuivante[1024];
+static unsigned char scenarioEnAttente = 0;
+static unsigned int scenarioLigne = 0;
+
+/**
+ * Réponse attendue à une trame du scénario.
+ */
+struct Attendu {
+    /** Ligne de la trame dans le scénario, ou 0 si aucune réponse
+     * n'est attendue.*/
+    unsigned int ligne;
+    /** Octets attendus après l'état de la trame, et 1 pour chacun de
+     * ceux qui doivent être comparés.*/
+    unsigned int longueur;
+    unsigned char octets[255];
+    unsigned char compare[255];
+};
+
+/**
+ * Réponse attendue à la trame en cours, et à chaque trame envoyée, par
+ * numéro de séquence.
+ */
+static struct Attendu scenarioAttendu;
+static struct Attendu attendus[256];
+
+/**
+ * Réponses vérifiées, et réponses non conformes ou manquantes.
+ */
+static unsigned int verifications = 0;
+static unsigned int erreurs = 0;
+
+/**
+ * Quadrants de la séquence de commutation par tour du moteur (1600
+ * micro-pas), et position des 2 quadrants où le capteur d'index est à 1.
+ */
+#define QUADRANTS_PAR_TOUR 200
+#define QUADRANT_INDEX 100
+
+/**
+ * Rotor du moteur, suivi d'après les commutateurs des ponts.
+ */
+static struct {
+    /** Quadrant de la séquence 5, 6, 10, 9 sur le port A.*/
+    int quadrant;
+    /** Position, en quadrants.*/
+    long position;
+} rotor;
+
+/**
+ * Boutons et décrochage du rotor simulés par les signaux, surintensité
+ * simulée par le scénario, et demande d'arrêt.
+ */
+static volatile sig_atomic_t boutonAvance = 0;
+static volatile sig_atomic_t boutonRecule = 0;
+static volatile sig_atomic_t glissement = 0;
+static volatile sig_atomic_t surintensite = 0;
+static volatile sig_atomic_t boutonMemorise = 0;
+static volatile sig_atomic_t boutonRejoue = 0;
+static volatile sig_atomic_t arret = 0;
+
+/**
+ * Cycles où les boutons de l'apprentissage sont relâchés.
+ */
+static unsigned long long memoriseFin = 0;
+static unsigned long long rejoueFin = 0;
+
+/**
+ * Mesures, en cycles d'instruction.
+ */
+static const char *mesuresFichier = 0;
+static struct {
+    /** Appels, cycles et durée maximum des interruptions.*/
+    unsigned long appels[3];
+    unsigned long long cycles[3];
+    unsigned long maximum[3];
+    /** TICTAC servies, et retard entre TMR2IF et l'interruption.*/
+    unsigned long tictacs;
+    unsigned long long retards;
+    unsigned long retardMaximum;
+    /** Cycle de la dernière levée de TMR2IF.*/
+    unsigned long long tmr2Leve;
+    /** Cycle de la fin de réception du dernier octet.*/
+    unsigned long long derniereReception;
+    /** TMR2IE au dernier accès, et 1 entre sa montée et le premier
+     * TICTAC, avec la fin de réception de la commande.*/
+    unsigned char tmr2Actif;
+    unsigned char demarrage;
+    unsigned long long commande;
+    /** Délais entre la fin de la commande et le premier pas.*/
+    unsigned long latences[TAILLE_LATENCES];
+    unsigned int nombreLatences;
+    /** Instructions des interruptions de haute priorité, au total et
+     * au plus (voir instructionCompte).*/
+    unsigned long long instructionsHp;
+    unsigned long instructionsHpMaximum;
+    /** Instructions et appels de crc8(), un par octet.*/
+    unsigned long long instructionsCrc;
+    unsigned long octetsCrc;
+} mesures;
+
+#ifdef COMPTE_INSTRUCTIONS
+#ifndef __x86_64__
+#error "COMPTE_INSTRUCTIONS demande un hôte x86-64"
+#endif
+/**
+ * Bornes du code du contrôleur, que le Makefile place dans la section
+ * controleur.
+ */
+extern const char __start_controleur[], __stop_controleur[];
+
+/**
+ * Instructions de l'hôte exécutées dans le code du contrôleur, et 1
+ * pendant qu'il est exécuté pas à pas.
+ */
+static unsigned long long instructions = 0;
+static unsigned char pasAPas = 0;
+
+/**
+ * CRC d'un octet, compté pas à pas en dehors des interruptions (voir
+ * __cyg_profile_func_enter), et le compte au début de l'appel en cours.
+ */
+unsigned char crc8(unsigned char crc, unsigned char octet);
+static unsigned char crcActif = 0;
+static unsigned long long crcDepart;
+
+/**
+ * Compte une instruction exécutée pas à pas, si elle appartient au
+ * contrôleur: le drapeau TF arrête le processeur après chaque
+ * instruction. Contrairement au modèle de cycles, qui ne voit que les
+ * accès aux registres et les appels, ce compte voit aussi les calculs
+ * et les branchements; compilé sans optimisation, le contrôleur y
+ * ressemble à peu près à ce que XC8 produit.
+ * @param signal SIGTRAP.
+ * @param info Inutilisé.
+ * @param contexte Le contexte interrompu, avec l'adresse de
+ * l'instruction suivante.
+ */
+static void instructionCompte(int signal, siginfo_t *info,
+        void *contexte) {
+    const char *adresse = (const char *)
+            ((ucontext_t *) contexte)->uc_mcontext.gregs[REG_RIP];
+
+    (void) signal;
+    (void) info;
+    if (adresse >= __start_controleur && adresse < __stop_controleur) {
+        instructions++;
+    }
+}
+
+/**
+ * Lève ou baisse le drapeau TF de l'exécution pas à pas. Pas sur place:
+ * pushfq écrirait dans la zone rouge de la fonction appelante.
+ * @param actif 1 pour le lever.
+ */
+static void __attribute__((noinline)) pasAPasActive(unsigned char actif) {
+    if (actif) {
+        __asm__ volatile("pushfq; orq $0x100, (%%rsp); popfq"
+                ::: "cc", "memory");
+    } else {
+        __asm__ volatile("pushfq; andq $~0x100, (%%rsp); popfq"
+                ::: "cc", "memory");
+    }
+}
+#endif
+
+/**
+ * Durée d'un octet sur la liaison série, en cycles d'instruction:
+ * 10 bits (départ, 8 bits, arrêt).
+ * @return La durée.
+ */
+static unsigned long cyclesOctet(void) {
+    unsigned long diviseur = (SPBRGH2_r << 8 | SPBRG2_r) + 1;
+
+    if (!BAUDCON2_r.b.BRG16 && !TXSTA2_r.b.BRGH) {
+        diviseur *= 16;
+    } else if (!BAUDCON2_r.b.BRG16 || !TXSTA2_r.b.BRGH) {
+        diviseur *= 4;
+    }
+    return 10 * diviseur;
+}
+
+/**
+ * Sauvegarde l'EEPROM dans son fichier.
+ */
+static void eepromSauvegarde(void) {
+    FILE *f;
+
+    if (!eepromFichier) {
+        return;
+    }
+    f = fopen(eepromFichier, "wb");
+    if (f) {
+        fwrite(eeprom, 1, sizeof(eeprom), f);
+        fclose(f);
+    }
+}
+
+/**
+ * Fait tourner le rotor d'un quadrant à chaque changement de quadrant
+ * des commutateurs, et met à jour le capteur d'index sur RB4. Les
+ * positions où un pont est ouvert ou court-circuité ne font pas tourner
+ * le rotor, dont le décrochage n'est pas simulé (voir scenarioLit).
+ */
+static void rotorSuit(void) {
+    static const signed char quadrants[16] = {
+        -1, -1, -1, -1, -1, 0, 1, -1, -1, 3, 2, -1, -1, -1, -1, -1
+    };
+    int q = quadrants[PORTA_r.v & 0x0F];
+    long n;
+
+    if (q >= 0 && q != rotor.quadrant) {
+        if (q == ((rotor.quadrant + 1) & 3)) {
+            rotor.position++;
+        } else if (q == ((rotor.quadrant + 3) & 3)) {
+            rotor.position--;
+        }
+        rotor.quadrant = q;
+    }
+    n = rotor.position % QUADRANTS_PAR_TOUR;
+    if (n < 0) {
+        n += QUADRANTS_PAR_TOUR;
+    }
+    n = n >= QUADRANT_INDEX && n < QUADRANT_INDEX + 2;
+    if (n != PORTB_r.b.RB4) {
+        PORTB_r.b.RB4 = n;
+        if (IOCB_r.b.IOCB4) {
+            INTCON_r.b.RBIF = 1;
+        }
+    }
+}
+
+/**
+ * Rend la conversion du shunt, commun aux deux ponts, sur AN9.
+ * Chaque bobine alimentée par ses commutateurs y apporte un courant
+ * proportionnel au rapport cyclique de son ENABLE: CCPR3L pour P3A, son
+ * complément moins DESEQUILIBRE_P3B pour P3B.
+ * @return La conversion, sur 10 bits.
+ */
+static unsigned int adcConvertit(void) {
+    int p3a = CCPR3L_r > PR2_r + 1 ? PR2_r + 1 : CCPR3L_r;
+    int p3b = PR2_r + 1 - p3a - DESEQUILIBRE_P3B;
+    int pont1 = PORTA_r.v & 0x03, pont2 = PORTA_r.v & 0x0C;
+    int rapport = 0;
+
+    if (ADCON0_r.b.CHS != 9 || !ANSELB_r.b.ANSB3) {
+        return 0;
+    }
+    if (pont1 == 0x01 || pont1 == 0x02) {
+        rapport += p3a;
+    }
+    if ((pont2 == 0x04 || pont2 == 0x08) && p3b > 0) {
+        rapport += p3b;
+    }
+    rapport *= ADC_PAR_RAPPORT;
+    return rapport > 1023 ? 1023 : rapport;
+}
+
+/**
+ * Traite les accès signalés depuis le dernier appel.
+ */
+static void acces(void) {
+    if (rcregLu) {
+        rcregLu = 0;
+        if (rxNombre > 0) {
+            rxNombre--;
+            rxFifo[0] = rxFifo[1];
+            RCREG2_r = rxFifo[0];
+        }
+    }
+    if (txregEcrit) {
+        txregEcrit = 0;
+        txTampon = TXREG2_r;
+        txPlein = 1;
+    }
+    if (tmr0Vu) {
+        tmr0Vu = 0;
+        if (TMR0L_r != tmr0Valeur) {
+            tmr0Suspendu = 2;
+            tmr0Prediviseur = 0;
+        }
+    }
+    if (EECON1_r.b.RD) {
+        EECON1_r.b.RD = 0;
+        EEDATA_r = eeprom[EEADR_r];
+    }
+    if (EECON1_r.b.WR && !eepromEcriture) {
+        eepromEcriture = 1;
+        eepromAdresse = EEADR_r;
+        eepromDonnee = EEDATA_r;
+        eepromFin = cycle + CYCLES_EEPROM;
+    }
+    if (ADCON0_r.b.GO && ADCON0_r.b.ADON && !adcConversion) {
+        adcConversion = 1;
+        adcFin = cycle + CYCLES_CONVERSION;
+    }
+    if (!RCSTA2_r.b.CREN) {
+        RCSTA2_r.b.OERR = 0;
+    }
+    if (PIE1_r.b.TMR2IE && !mesures.tmr2Actif) {
+        mesures.demarrage = 1;
+        mesures.commande = mesures.derniereReception;
+    }
+    mesures.tmr2Actif = PIE1_r.b.TMR2IE;
+
+    // Entrées: FLT0 au repos, boutons relâchés sauf ceux de
+    // l'apprentissage pendant leur appui.
+    PORTB_r.b.RB0 = 1;
+    PORTB_r.b.RB1 = 1;
+    PORTB_r.b.RB2 = 1;
+    PORTC_r.b.RC0 = cycle >= memoriseFin;
+    PORTC_r.b.RC1 = cycle >= rejoueFin;
+    rotorSuit();
+}
+
+/**
+ * Fait évoluer les périphériques pendant un cycle d'instruction.
+ */
+static void periodique(void) {
+    unsigned char prediviseur;
+    unsigned int conversion;
+
+    cycle++;
+
+    // Temporisateur 0, en mode 8 bits:
+    if (T0CON_r.b.TMR0ON && !T0CON_r.b.T0CS) {
+        if (tmr0Suspendu) {
+            tmr0Suspendu--;
+        } else {
+            prediviseur = T0CON_r.b.PSA ? 1 : 2 << T0CON_r.b.T0PS;
+            if (++tmr0Prediviseur >= prediviseur) {
+                tmr0Prediviseur = 0;
+                if (++TMR0L_r == 0) {
+                    INTCON_r.b.TMR0IF = 1;
+                }
+            }
+        }
+    }
+
+    // Temporisateur 2:
+    if (T2CON_r.b.TMR2ON) {
+        prediviseur = T2CON_r.b.T2CKPS == 0 ? 1
+                : T2CON_r.b.T2CKPS == 1 ? 4 : 16;
+        if (++tmr2Prediviseur >= prediviseur) {
+            tmr2Prediviseur = 0;
+            if (TMR2_r == PR2_r) {
+                TMR2_r = 0;
+                if (++tmr2Postdiviseur > T2CON_r.b.T2OUTPS) {
+                    tmr2Postdiviseur = 0;
+                    PIR1_r.b.TMR2IF = 1;
+                    mesures.tmr2Leve = cycle;
+                }
+            } else {
+                TMR2_r++;
+            }
+        }
+    }
+
+    // Temporisateur 4:
+    if (T4CON_r.b.TMR4ON) {
+        prediviseur = T4CON_r.b.T4CKPS == 0 ? 1
+                : T4CON_r.b.T4CKPS == 1 ? 4 : 16;
+        if (++tmr4Prediviseur >= prediviseur) {
+            tmr4Prediviseur = 0;
+            if (TMR4_r == PR4_r) {
+                TMR4_r = 0;
+                if (++tmr4Postdiviseur > T4CON_r.b.T4OUTPS) {
+                    tmr4Postdiviseur = 0;
+                    PIR5_r.b.TMR4IF = 1;
+                }
+            } else {
+                TMR4_r++;
+            }
+        }
+    }
+
+    // Réception: un octet du pseudo-terminal arrive à la fois.
+    if (RCSTA2_r.b.SPEN && RCSTA2_r.b.CREN) {
+        if (!rxOccupe && entreeDebut != entreeFin) {
+            rxOctet = entree[entreeDebut];
+            entreeDebut = (entreeDebut + 1) % TAILLE_FILE;
+            rxFin = cycle + cyclesOctet();
+            rxOccupe = 1;
+        } else if (rxOccupe && cycle >= rxFin) {
+            rxOccupe = 0;
+            if (RCSTA2_r.b.OERR) {
+                // Le EUSART ne reçoit plus rien jusqu'à CREN = 0.
+            } else if (rxNombre == 2) {
+                RCSTA2_r.b.OERR = 1;
+            } else {
+                rxFifo[rxNombre++] = rxOctet;
+                mesures.derniereReception = cycle;
+                RCREG2_r = rxFifo[0];
+            }
+        }
+    }
+    PIR3_r.b.RC2IF = rxNombre > 0;
+
+    // Émission:
+    if (RCSTA2_r.b.SPEN && TXSTA2_r.b.TXEN) {
+        if (txOccupe && cycle >= txFin) {
+            txOccupe = 0;
+            if (sortieFin < TAILLE_FILE) {
+                sortie[sortieFin++] = txOctet;
+            }
+        }
+        if (!txOccupe && txPlein) {
+            txOctet = txTampon;
+            txPlein = 0;
+            txOccupe = 1;
+            txFin = cycle + cyclesOctet();
+        }
+        PIR3_r.b.TX2IF = !txPlein;
+        TXSTA2_r.b.TRMT = !txOccupe;
+    }
+
+    // EEPROM:
+    if (eepromEcriture && cycle >= eepromFin) {
+        eepromEcriture = 0;
+        eeprom[eepromAdresse] = eepromDonnee;
+        EECON1_r.b.WR = 0;
+        PIR2_r.b.EEIF = 1;
+        eepromSauvegarde();
+    }
+
+    // Convertisseur A/D, résultat aligné à droite:
+    if (adcConversion && cycle >= adcFin) {
+        conversion = adcConvertit();
+        adcConversion = 0;
+        ADRESH_r = conversion >> 8;
+        ADRESL_r = conversion & 0xFF;
+        ADCON0_r.b.GO = 0;
+    }
+}
+
+/**
+ * Ajoute un octet au CRC-8 des trames (polynôme 0x07).
+ * @param crc CRC des octets précédents.
+ * @param octet L'octet.
+ * @return Le nouveau CRC.
+ */
+static unsigned char trameCrc8(unsigned char crc, unsigned char octet) {
+    unsigned char bit;
+
+    crc ^= octet;
+    for (bit = 0; bit < 8; bit++) {
+        crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+/**
+ * Lit une ligne du scénario, sans le texte après #.
+ * @param ligne Reçoit la ligne.
+ * @return 0 à la fin du scénario.
+ */
+static int scenarioLigneLit(char *ligne) {
+    char *p;
+
+    if (scenarioEnAttente) {
+        scenarioEnAttente = 0;
+        strcpy(ligne, scenarioSuivante);
+        return 1;
+    }
+    if (!fgets(ligne, sizeof(scenarioSuivante), scenario)) {
+        return 0;
+    }
+    scenarioLigne++;
+    if ((p = strchr(ligne, '#'))) {
+        *p = 0;
+    }
+    return 1;
+}
+
+/**
+ * Ajoute des octets à la réponse attendue à la trame en cours: des
+ * octets en hexadécimal, ou .. pour un octet quelconque.
+ * @param p Les octets.
+ */
+static void scenarioAttenduLit(char *p) {
+    struct Attendu *a = &scenarioAttendu;
+    unsigned long octet;
+    char *suite;
+
+    while (a->longueur < sizeof(a->octets)) {
+        p += strspn(p, " \t\r\n");
+        if (strncmp(p, "..", 2) == 0) {
+            a->compare[a->longueur++] = 0;
+            p += 2;
+            continue;
+        }
+        octet = strtoul(p, &suite, 16);
+        if (suite == p) {
+            return;
+        }
+        a->octets[a->longueur] = octet;
+        a->compare[a->longueur++] = 1;
+        p = suite;
+    }
+}
+
+/**
+ * Forme la trame des commandes en cours, avec le prochain numéro de
+ * séquence et le CRC, et retient la réponse qu'elle attend.
+ */
+static void scenarioTrameForme(void) {
+    unsigned char crc = 0;
+    unsigned int n;
+
+    scenarioTrame[0] = 0xA5;
+    scenarioTrame[1] = scenarioNombre;
+    scenarioTrame[2] = scenarioSequence;
+    memcpy(scenarioTrame + 3, scenarioCommandes, scenarioNombre);
+    for (n = 1; n < 3 + scenarioNombre; n++) {
+        crc = trameCrc8(crc, scenarioTrame[n]);
+    }
+    scenarioTrame[n++] = crc;
+    scenarioLongueur = n;
+    attendus[scenarioSequence++] = scenarioAttendu;
+}
+
+/**
+ * Lit la prochaine trame du scénario. Chaque ligne est le temps en ms
+ * depuis le démarrage, puis les commandes d'une trame en hexadécimal,
+ * le mot glisse, qui fait perdre 32 micro-pas au rotor, le mot
+ * surintensite, une brève impulsion sur l'entrée de défaut, le mot rotor
+ * suivi de la position en quadrants que le rotor doit avoir (voir
+ * rotorSuit), ou le mot fin.
+ * Le temps debut-fin/pas répète la trame toutes les pas ms, de debut à
+ * fin. Les numéros de séquence et le CRC sont ajoutés.
+ * Les lignes qui suivent une trame et commencent par > donnent la
+ * réponse attendue: les réponses de ses commandes, en hexadécimal, où
+ * .. remplace un octet quelconque. Le simulateur la compare à celle du
+ * contrôleur (voir scenarioReponse).
+ * Le texte après # est ignoré.
+ */
+static void scenarioLit(void) {
+    char ligne[sizeof(scenarioSuivante)], *p, *suite;
+    unsigned long ms, fin, pas;
+    unsigned long octet;
+
+    scenarioAttendu.ligne = 0;
+    scenarioAttendu.longueur = 0;
+    while (scenarioLigneLit(ligne)) {
+        p = ligne + strspn(ligne, " \t");
+        if (*p == '>') {
+            fprintf(stderr, "ligne %u: réponse attendue sans trame\n",
+                    scenarioLigne);
+            erreurs++;
+            continue;
+        }
+        ms = strtoul(ligne, &p, 10);
+        if (p == ligne) {
+            continue;
+        }
+        scenarioCycle = (unsigned long long) ms * (FCY / 1000);
+        scenarioRepetition = 0;
+        if (*p == '-') {
+            fin = strtoul(p + 1, &p, 10);
+            pas = *p == '/' ? strtoul(p + 1, &p, 10) : 0;
+            if (pas > 0) {
+                scenarioRepetition = (unsigned long long) fin * (FCY / 1000);
+                scenarioPas = (unsigned long long) pas * (FCY / 1000);
+            }
+        }
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        scenarioNumero = scenarioLigne;
+        if (strncmp(p, "fin", 3) == 0) {
+            scenarioAction = FIN;
+            return;
+        }
+        if (strncmp(p, "glisse", 6) == 0) {
+            scenarioAction = GLISSE;
+            return;
+        }
+        if (strncmp(p, "surintensite", 12) == 0) {
+            scenarioAction = SURINTENSITE;
+            return;
+        }
+        if (strncmp(p, "rotor", 5) == 0) {
+            scenarioAction = ROTOR;
+            scenarioRotor = strtol(p + 5, 0, 10);
+            return;
+        }
+        scenarioAction = TRAME;
+        scenarioNombre = 0;
+        while ((octet = strtoul(p, &suite, 16)), suite != p
+                && scenarioNombre < sizeof(scenarioCommandes)) {
+            scenarioCommandes[scenarioNombre++] = octet;
+            p = suite;
+        }
+
+        // La réponse attendue, sur les lignes qui suivent:
+        while (scenarioLigneLit(ligne)) {
+            p = ligne + strspn(ligne, " \t");
+            if (*p != '>') {
+                strcpy(scenarioSuivante, ligne);
+                scenarioEnAttente = 1;
+                break;
+            }
+            scenarioAttendu.ligne = scenarioNumero;
+            scenarioAttenduLit(p + 1);
+        }
+        scenarioTrameForme();
+        return;
+    }
+    scenarioAction = FIN;
+}
+
+/**
+ * Décode les trames de réponse du contrôleur, et compare chacune à la
+ * réponse attendue par la trame qu'elle acquitte: l'état doit être
+ * TRAME_ACCEPTEE (0), et les réponses des commandes celles attendues.
+ * @param octet Le prochain octet émis par le contrôleur.
+ */
+static void scenarioReponse(unsigned char octet) {
+    static unsigned char trame[4 + 255];
+    static unsigned int n = 0;
+    struct Attendu *a;
+    unsigned char crc = 0;
+    unsigned int i, longueur, conforme;
+
+    if (n == 0 && octet != 0xA5) {
+        return;
+    }
+    trame[n++] = octet;
+    if (n < 4 || n < trame[1] + 4u) {
+        return;
+    }
+    n = 0;
+
+    // Synchronisation, longueur, acquittement, état, réponses, CRC:
+    longueur = trame[1];
+    for (i = 1; i < longueur + 3; i++) {
+        crc = trameCrc8(crc, trame[i]);
+    }
+    a = &attendus[(unsigned char) (trame[2] - 1)];
+    if (!a->ligne) {
+        return;
+    }
+    verifications++;
+    conforme = crc == trame[longueur + 3] && trame[3] == 0
+            && longueur - 1 == a->longueur;
+    for (i = 0; conforme && i < a->longueur; i++) {
+        if (a->compare[i] && trame[4 + i] != a->octets[i]) {
+            conforme = 0;
+        }
+    }
+    if (!conforme) {
+        erreurs++;
+        fprintf(stderr, "ligne %u: réponse", a->ligne);
+        for (i = 3; i < longueur + 3; i++) {
+            fprintf(stderr, " %02X", trame[i]);
+        }
+        fprintf(stderr, ", attendu 00");
+        for (i = 0; i < a->longueur; i++) {
+            if (a->compare[i]) {
+                fprintf(stderr, " %02X", a->octets[i]);
+            } else {
+                fprintf(stderr, " ..");
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    a->ligne = 0;
+}
+
+/**
+ * Envoie les trames du scénario dont le moment est venu, et vérifie les
+ * réponses.
+ */
+static void scenarioJoue(void) {
+    unsigned int n;
+
+    for (n = 0; n < sortieFin; n++) {
+        scenarioReponse(sortie[n]);
+    }
+    sortieFin = 0;
+    while (cycle >= scenarioCycle) {
+        switch (scenarioAction) {
+            case TRAME:
+                for (n = 0; n < scenarioLongueur; n++) {
+                    entree[entreeFin] = scenarioTrame[n];
+                    entreeFin = (entreeFin + 1) % TAILLE_FILE;
+                }
+                break;
+            case GLISSE:
+                glissement = 1;
+                break;
+            case SURINTENSITE:
+                surintensite = 1;
+                break;
+            case ROTOR:
+                verifications++;
+                if (rotor.position != scenarioRotor) {
+                    fprintf(stderr, "ligne %u: rotor au quadrant %ld, "
+                            "attendu %ld\n", scenarioNumero,
+                            rotor.position, scenarioRotor);
+                    erreurs++;
+                }
+                break;
+            case FIN:
+                termine();
+        }
+        if (scenarioAction == TRAME && scenarioRepetition
+                && scenarioCycle + scenarioPas <= scenarioRepetition) {
+            scenarioCycle += scenarioPas;
+            scenarioTrameForme();
+        } else {
+            scenarioLit();
+        }
+    }
+}
+
+/**
+ * Échange les octets avec le pseudo-terminal, prend en compte les
+ * boutons, et attend si le temps simulé est en avance sur le temps réel.
+ */
+static void rythme(void) {
+    struct timespec maintenant, attente;
+    unsigned char tampon[256];
+    unsigned int n;
+    ssize_t lus;
+    double avance;
+
+    prochainRythme = cycle + CYCLES_RYTHME;
+
+    // Les octets reçus, du scénario ou du pseudo-terminal:
+    if (scenario) {
+        scenarioJoue();
+    } else {
+        do {
+            n = (entreeDebut + TAILLE_FILE - entreeFin - 1) % TAILLE_FILE;
+            if (n > sizeof(tampon)) {
+                n = sizeof(tampon);
+            }
+            lus = n ? read(maitre, tampon, n) : 0;
+            for (n = 0; lus > 0 && n < (unsigned int) lus; n++) {
+                entree[entreeFin] = tampon[n];
+                entreeFin = (entreeFin + 1) % TAILLE_FILE;
+            }
+        } while (lus == sizeof(tampon));
+    }
+
+    // Les octets émis:
+    if (sortieFin > 0 && !scenario) {
+        lus = write(maitre, sortie, sortieFin);
+        if (lus > 0) {
+            memmove(sortie, sortie + lus, sortieFin - lus);
+            sortieFin -= lus;
+        }
+    }
+
+    // Les boutons déclenchent INT2 et INT1 sur flanc descendant:
+    if (boutonAvance) {
+        boutonAvance = 0;
+        INTCON3_r.b.INT2IF = 1;
+    }
+    if (boutonRecule) {
+        boutonRecule = 0;
+        INTCON3_r.b.INT1IF = 1;
+    }
+
+    // L'entrée de défaut RB0 déclenche INT0; elle est déjà revenue au
+    // repos quand le contrôleur la relit:
+    if (surintensite) {
+        surintensite = 0;
+        INTCON_r.b.INT0IF = 1;
+    }
+
+    // Les boutons de l'apprentissage restent enfoncés un moment:
+    if (boutonMemorise) {
+        memoriseFin = cycle + (boutonMemorise > 1
+                ? CYCLES_APPUI_LONG : CYCLES_APPUI);
+        boutonMemorise = 0;
+    }
+    if (boutonRejoue) {
+        boutonRejoue = 0;
+        rejoueFin = cycle + CYCLES_APPUI;
+    }
+
+    // Le rotor décroche, et perd un cycle de la séquence de commutation:
+    if (glissement) {
+        glissement = 0;
+        rotor.position -= 4;
+    }
+
+    if (arret) {
+        termine();
+    }
+
+    // Le rythme du temps réel:
+    if (facteur > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &maintenant);
+        avance = (double) cycle / FCY / facteur
+                - (maintenant.tv_sec - debut.tv_sec)
+                - (maintenant.tv_nsec - debut.tv_nsec) / 1e9;
+        if (avance > 0.002) {
+            attente.tv_sec = (time_t) avance;
+            attente.tv_nsec = (long) ((avance - attente.tv_sec) * 1e9);
+            nanosleep(&attente, 0);
+        }
+    }
+}
+
+/**
+ * Indique si une interruption de la priorité indiquée est en attente.
+ * Sans IPEN, toutes les interruptions sont de haute priorité.
+ * @param haute 1 pour la haute priorité, 0 pour la basse.
+ * @return 1 si une interruption est en attente.
+ */
+static unsigned char enAttente(unsigned char haute) {
+    unsigned char ipen = RCON_r.b.IPEN;
+
+#define SOURCE(f, e, p) \
+    if ((f) && (e) && (!ipen || (p) == haute)) return 1;
+    SOURCE(INTCON_r.b.INT0IF, INTCON_r.b.INT0IE, 1)
+    SOURCE(INTCON_r.b.RBIF, INTCON_r.b.RBIE, INTCON2_r.b.RBIP)
+    SOURCE(INTCON3_r.b.INT1IF, INTCON3_r.b.INT1IE, INTCON3_r.b.INT1IP)
+    SOURCE(INTCON3_r.b.INT2IF, INTCON3_r.b.INT2IE, INTCON3_r.b.INT2IP)
+    SOURCE(INTCON_r.b.TMR0IF, INTCON_r.b.TMR0IE, INTCON2_r.b.TMR0IP)
+    SOURCE(PIR1_r.b.TMR2IF, PIE1_r.b.TMR2IE, IPR1_r.b.TMR2IP)
+    SOURCE(PIR5_r.b.TMR4IF, PIE5_r.b.TMR4IE, IPR5_r.b.TMR4IP)
+    SOURCE(PIR3_r.b.RC2IF, PIE3_r.b.RC2IE, IPR3_r.b.RC2IP)
+    SOURCE(PIR3_r.b.TX2IF, PIE3_r.b.TX2IE, IPR3_r.b.TX2IP)
+#undef SOURCE
+    return 0;
+}
+
+/**
+ * Appelle une routine d'interruption, en comptant les cycles d'entrée
+ * et de sortie. La durée d'une interruption de basse priorité comprend
+ * celle des interruptions de haute priorité qui l'ont interrompue.
+ * @param n Niveau de la routine.
+ * @param routine La routine.
+ */
+static void interruption(unsigned char n, void (*routine)(void)) {
+    unsigned char precedent = niveau;
+    unsigned long long depart = cycle;
+    unsigned long duree;
+    unsigned char c;
+#ifdef COMPTE_INSTRUCTIONS
+    unsigned long long compte = 0;
+#endif
+
+    // Le retard de la TICTAC, et le premier pas d'un mouvement:
+    if (n == 2 && PIR1_r.b.TMR2IF && PIE1_r.b.TMR2IE) {
+        duree = cycle - mesures.tmr2Leve;
+        mesures.tictacs++;
+        mesures.retards += duree;
+        if (duree > mesures.retardMaximum) {
+            mesures.retardMaximum = duree;
+        }
+        if (mesures.demarrage) {
+            mesures.demarrage = 0;
+            if (mesures.nombreLatences < TAILLE_LATENCES) {
+                mesures.latences[mesures.nombreLatences++] =
+                        cycle - mesures.commande;
+            }
+        }
+    }
+
+    niveau = n;
+    for (c = 0; c < CYCLES_ENTREE; c++) {
+        periodique();
+    }
+#ifdef COMPTE_INSTRUCTIONS
+    // Les interruptions de haute priorité, pas à pas:
+    if (n == 2) {
+        compte = instructions;
+        pasAPas = 1;
+        pasAPasActive(1);
+    }
+#endif
+    routine();
+#ifdef COMPTE_INSTRUCTIONS
+    if (n == 2) {
+        pasAPasActive(0);
+        pasAPas = 0;
+        compte = instructions - compte;
+        mesures.instructionsHp += compte;
+        if (compte > mesures.instructionsHpMaximum) {
+            mesures.instructionsHpMaximum = compte;
+        }
+    }
+#endif
+    for (c = 0; c < CYCLES_SORTIE; c++) {
+        periodique();
+    }
+    niveau = precedent;
+
+    duree = cycle - depart;
+    mesures.appels[n]++;
+    mesures.cycles[n] += duree;
+    if (duree > mesures.maximum[n]) {
+        mesures.maximum[n] = duree;
+    }
+}
+
+/**
+ * Compare deux délais, pour qsort.
+ */
+static int compareLatences(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *) a;
+    unsigned long y = *(const unsigned long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Écrit les mesures dans leur fichier, une par ligne: le nom, puis la
+ * valeur en cycles d'instruction (4µs chacun).
+ *   cycles               Temps simulé.
+ *   hp_appels, hp_moyen, hp_maximum
+ *   bp_appels, bp_moyen, bp_maximum
+ *                        Interruptions de haute et basse priorité.
+ *   tictac_appels, tictac_retard_moyen, tictac_retard_maximum
+ *                        Retard entre TMR2IF et l'interruption, dû
+ *                        aux sections où le programme principal
+ *                        suspend les interruptions de haute priorité.
+ *   mouvement_nombre, mouvement_p50, mouvement_p99, mouvement_maximum
+ *                        Délai entre la fin de réception de la trame
+ *                        qui démarre un mouvement et son premier pas.
+ *   tmr2_periode         Période des interruptions du temporisateur 2,
+ *                        selon sa dernière configuration.
+ * Avec COMPTE_INSTRUCTIONS, suivent des nombres d'instructions de
+ * l'hôte exécutées par le contrôleur (voir instructionCompte):
+ *   hp_instructions_moyen, hp_instructions_maximum
+ *                        Par interruption de haute priorité.
+ *   crc_instructions_octet
+ *                        Par octet ajouté au CRC des trames.
+ */
+static void mesuresEcrit(void) {
+    FILE *f;
+    unsigned int n = mesures.nombreLatences;
+
+    if (!mesuresFichier || !(f = fopen(mesuresFichier, "w"))) {
+        return;
+    }
+    fprintf(f, "cycles %llu\n", cycle);
+    fprintf(f, "hp_appels %lu\n", mesures.appels[2]);
+    fprintf(f, "hp_moyen %llu\n", mesures.appels[2]
+            ? mesures.cycles[2] / mesures.appels[2] : 0);
+    fprintf(f, "hp_maximum %lu\n", mesures.maximum[2]);
+    fprintf(f, "bp_appels %lu\n", mesures.appels[1]);
+    fprintf(f, "bp_moyen %llu\n", mesures.appels[1]
+            ? mesures.cycles[1] / mesures.appels[1] : 0);
+    fprintf(f, "bp_maximum %lu\n", mesures.maximum[1]);
+    fprintf(f, "tictac_appels %lu\n", mesures.tictacs);
+    fprintf(f, "tictac_retard_moyen %llu\n", mesures.tictacs
+            ? mesures.retards / mesures.tictacs : 0);
+    fprintf(f, "tictac_retard_maximum %lu\n", mesures.retardMaximum);
+    qsort(mesures.latences, n, sizeof(mesures.latences[0]),
+            compareLatences);
+    fprintf(f, "mouvement_nombre %u\n", n);
+    fprintf(f, "mouvement_p50 %lu\n", n ? mesures.latences[n / 2] : 0);
+    fprintf(f, "mouvement_p99 %lu\n",
+            n ? mesures.latences[n * 99 / 100] : 0);
+    fprintf(f, "mouvement_maximum %lu\n", n ? mesures.latences[n - 1] : 0);
+    fprintf(f, "tmr2_periode %u\n", (T2CON_r.b.T2CKPS == 0 ? 1
+            : T2CON_r.b.T2CKPS == 1 ? 4 : 16)
+            * (PR2_r + 1) * (T2CON_r.b.T2OUTPS + 1));
+#ifdef COMPTE_INSTRUCTIONS
+    fprintf(f, "hp_instructions_moyen %llu\n", mesures.appels[2]
+            ? mesures.instructionsHp / mesures.appels[2] : 0);
+    fprintf(f, "hp_instructions_maximum %lu\n",
+            mesures.instructionsHpMaximum);
+    fprintf(f, "crc_instructions_octet %llu\n", mesures.octetsCrc
+            ? mesures.instructionsCrc / mesures.octetsCrc : 0);
+#endif
+    fclose(f);
+}
+
+/**
+ * Écrit les mesures, efface le lien vers le pseudo-terminal, et
+ * termine. Termine en erreur si une réponse du scénario n'est pas
+ * conforme, ou n'est pas arrivée.
+ */
+static void termine(void) {
+    unsigned int n;
+
+    mesuresEcrit();
+    if (lien) {
+        unlink(lien);
+    }
+    for (n = 0; n < 256; n++) {
+        if (attendus[n].ligne) {
+            fprintf(stderr, "ligne %u: pas de réponse\n", attendus[n].ligne);
+            erreurs++;
+        }
+    }
+    if (verifications || erreurs) {
+        printf("%u réponses vérifiées, %u erreurs\n", verifications,
+                erreurs);
+    }
+    exit(erreurs ? 1 : 0);
+}
+
+/**
+ * Fait avancer le temps simulé, et appelle les interruptions.
+ * @param cycles Cycles d'instruction écoulés.
+ */
+static void avance(unsigned char cycles) {
+    acces();
+    while (cycles--) {
+        periodique();
+    }
+    if (cycle >= prochainRythme) {
+        rythme();
+    }
+    if (!INTCON_r.b.GIEH) {
+        return;
+    }
+    if (niveau < 2 && enAttente(1)) {
+        interruption(2, interruptionsHP);
+    }
+    if (niveau < 1 && (INTCON_r.b.GIEL || !RCON_r.b.IPEN)
+            && enAttente(0)) {
+        interruption(1, interruptionsBP);
+    }
+}
+
+/**
+ * Fait avancer le temps simulé pour le contrôleur, à chaque accès à
+ * un registre et à chaque appel. Le travail du simulateur n'est pas
+ * exécuté pas à pas.
+ * @param cycles Cycles d'instruction de l'accès ou de l'appel.
+ */
+void simAvance(unsigned char cycles) {
+#ifdef COMPTE_INSTRUCTIONS
+    if (pasAPas) {
+        pasAPasActive(0);
+        avance(cycles);
+        pasAPasActive(1);
+        return;
+    }
+#endif
+    avance(cycles);
+}
+
+/**
+ * Compte le CALL de chaque fonction du contrôleur, compilé avec
+ * -finstrument-functions (voir Makefile). Les routines d'interruption
+ * et programme() en sont exclues: leur entrée et leur sortie sont
+ * comptées par interruption().
+ * @param fonction La fonction appelée.
+ * @param appel L'adresse de l'appel.
+ */
+void __cyg_profile_func_enter(void *fonction, void *appel) {
+    (void) fonction;
+    (void) appel;
+    simAvance(CYCLES_CALL);
+#ifdef COMPTE_INSTRUCTIONS
+    // Après simAvance, pour ne pas compter d'interruption avec le CRC:
+    if (fonction == (void *) crc8 && !pasAPas) {
+        crcActif = 1;
+        crcDepart = instructions;
+        pasAPasActive(1);
+    }
+#endif
+}
+
+/**
+ * Compte le RETURN de chaque fonction du contrôleur.
+ * @param fonction La fonction qui se termine.
+ * @param appel L'adresse de l'appel.
+ */
+void __cyg_profile_func_exit(void *fonction, void *appel) {
+    (void) fonction;
+    (void) appel;
+#ifdef COMPTE_INSTRUCTIONS
+    if (crcActif && fonction == (void *) crc8) {
+        pasAPasActive(0);
+        crcActif = 0;
+        mesures.instructionsCrc += instructions - crcDepart;
+        mesures.octetsCrc++;
+    }
+#endif
+    simAvance(CYCLES_RETURN);
+}
+
+volatile unsigned char *simRCREG2(void) {
+    simAvance(CYCLES_ACCES);
+    rcregLu = 1;
+    return &RCREG2_r;
+}
+
+volatile unsigned char *simTXREG2(void) {
+    simAvance(CYCLES_ACCES);
+    txregEcrit = 1;
+    return &TXREG2_r;
+}
+
+volatile unsigned char *simTMR0L(void) {
+    simAvance(CYCLES_ACCES);
+    tmr0Vu = 1;
+    tmr0Valeur = TMR0L_r;
+    return &TMR0L_r;
+}
+
+/**
+ * Reçoit les signaux des boutons.
+ * @param signal Le signal.
+ */
+static void bouton(int signal) {
+    if (signal == SIGUSR1) {
+        boutonAvance = 1;
+    } else {
+        boutonRecule = 1;
+    }
+}
+
+/**
+ * Reçoit les signaux des boutons de l'apprentissage.
+ * @param signal Le signal.
+ */
+static void apprentissage(int signal) {
+    if (signal == SIGRTMIN) {
+        boutonMemorise = 1;
+    } else if (signal == SIGRTMIN + 1) {
+        boutonRejoue = 1;
+    } else {
+        boutonMemorise = 2;
+    }
+}
+
+/**
+ * Reçoit le signal de décrochage du rotor.
+ * @param signal Le signal.
+ */
+static void glisse(int signal) {
+    (void) signal;
+    glissement = 1;
+}
+
+/**
+ * Demande l'arrêt du simulateur, qui a lieu au prochain rythme.
+ * @param signal Le signal.
+ */
+static void arrete(int signal) {
+    (void) signal;
+    arret = 1;
+}
+
+/**
+ * Ouvre le pseudo-terminal. L'esclave reste ouvert pour que le maître
+ * ne soit pas fermé quand un client se déconnecte.
+ * @return Le nom de l'esclave.
+ */
+static const char *ouvrePseudoTerminal(void) {
+    struct termios t;
+    const char *nom;
+    int esclave;
+
+    maitre = posix_openpt(O_RDWR | O_NOCTTY);
+    if (maitre < 0 || grantpt(maitre) || unlockpt(maitre)) {
+        perror("posix_openpt");
+        exit(1);
+    }
+    nom = ptsname(maitre);
+    esclave = open(nom, O_RDWR | O_NOCTTY);
+    if (esclave < 0 || tcgetattr(esclave, &t)) {
+        perror(nom);
+        exit(1);
+    }
+    cfmakeraw(&t);
+    tcsetattr(esclave, TCSANOW, &t);
+    fcntl(maitre, F_SETFL, O_NONBLOCK);
+    return nom;
+}
+
+int main(int argc, char **argv) {
+    const char *nom;
+    FILE *f;
+    int option;
+
+    while ((option = getopt(argc, argv, "l:e:x:m:s:")) != -1) {
+        switch (option) {
+            case 'l':
+                lien = optarg;
+                break;
+            case 'e':
+                eepromFichier = optarg;
+                break;
+            case 'x':
+                facteur = atof(optarg);
+                break;
+            case 'm':
+                mesuresFichier = optarg;
+                break;
+            case 's':
+                scenario = fopen(optarg, "r");
+                if (!scenario) {
+                    perror(optarg);
+                    return 1;
+                }
+                facteur = 0;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-l lien] [-e eeprom] [-x facteur]"
+                        " [-m mesures] [-s scenario]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    if (eepromFichier && (f = fopen(eepromFichier, "rb"))) {
+        if (fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom)) {
+            fprintf(stderr, "%s: EEPROM incomplète\n", eepromFichier);
+        }
+        fclose(f);
+    }
+
+    if (scenario) {
+        scenarioLit();
+    } else {
+        nom = ouvrePseudoTerminal();
+        if (lien) {
+            unlink(lien);
+            if (symlink(nom, lien)) {
+                perror(lien);
+                return 1;
+            }
+        }
+        printf("%s\n", lien ? lien : nom);
+        fflush(stdout);
+    }
+
+    signal(SIGUSR1, bouton);
+    signal(SIGUSR2, bouton);
+    signal(SIGHUP, glisse);
+    signal(SIGRTMIN, apprentissage);
+    signal(SIGRTMIN + 1, apprentissage);
+    signal(SIGRTMIN + 2, apprentissage);
+    signal(SIGINT, arrete);
+    signal(SIGTERM, arrete);
+    signal(SIGPIPE, SIG_IGN);
+#ifdef COMPTE_INSTRUCTIONS
+    {
+        struct sigaction trace;
+
+        memset(&trace, 0, sizeof(trace));
+        trace.sa_sigaction = instructionCompte;
+        trace.sa_flags = SA_SIGINFO;
+        sigaction(SIGTRAP, &trace, 0);
+    }
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &debut);
+    programme();
+    return 0;
+}
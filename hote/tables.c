@@ -0,0 +1,178 @@
+/*
+ * Calcule les tables de commutation du contrôleur (voir
+ * TableCommutation dans controleur-stepper.c).
+ *
+ * Le ECCP3 commande les deux bobines en demi-pont: le courant de la
+ * première suit le rapport cyclique r, celui de la seconde 32 - r.
+ * Le rotor s'arrête là où le couple des bobines équilibre le couple de
+ * détente du moteur hybride:
+ *     (32 - r) cos a - r sin a - d sin 4a = 0
+ * où a est l'angle électrique dans le quadrant, et d le couple de
+ * détente rapporté au couple d'une bobine à 32.
+ *
+ * Les tables sinus (par défaut) sont celles d'origine:
+ *     r = 16 + 16 cos(n x 180° / 8)
+ * La somme des courants étant fixe, l'angle n'avance pas d'un
+ * micro-pas à l'autre de 90° / 8, mais de 1° à 26°.
+ * Les tables de couple linéaire (-c) résolvent l'équilibre pour que le
+ * micro-pas n place le rotor à n x 90° / 8:
+ *     r = (32 cos a - d sin 4a) / (cos a + sin a)
+ *
+ * Usage: tables [-c] [-d detente] [-u]
+ *   -c         Tables de couple linéaire.
+ *   -d detente Couple de détente, en pour cent du couple d'une bobine
+ *              au courant maximum. Par défaut 8.
+ *   -u         Écrit les données de COMMANDE_TABLE en hexadécimal,
+ *              comme dans un scénario du simulateur, au lieu des
+ *              initialisations en C.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Rapport cyclique pour un courant maximum, et 90° électriques.
+ */
+#define RAPPORT_MAX 32
+#define QUART M_PI_2
+
+/**
+ * Micro-pas par quadrant.
+ */
+#define MICRO_PAS 8
+
+/**
+ * Séquence de commutation pour le déplacement.
+ */
+static const int commutateurs[4] = { 5, 6, 10, 9 };
+
+/**
+ * Rend le rapport cyclique du micro-pas n, entre 0 et 8, qui place le
+ * rotor à l'angle n x 90° / 8.
+ * @param n Le micro-pas dans le quadrant.
+ * @param d Le couple de détente, rapporté au couple d'une bobine.
+ */
+static double rapportLineaire(int n, double d) {
+    double a = n * QUART / MICRO_PAS;
+    double r;
+
+    r = RAPPORT_MAX * (cos(a) - d * sin(4 * a)) / (cos(a) + sin(a));
+    if (r < 0) {
+        return 0;
+    }
+    if (r > RAPPORT_MAX) {
+        return RAPPORT_MAX;
+    }
+    return r;
+}
+
+/**
+ * Rend le rapport cyclique d'origine du micro-pas n, entre 0 et 8.
+ */
+static double rapportSinus(int n) {
+    return RAPPORT_MAX / 2 * (1 + cos(n * M_PI / MICRO_PAS));
+}
+
+/**
+ * Rend l'angle où le rapport cyclique r place le rotor, en degrés,
+ * par dichotomie sur l'équilibre des couples.
+ */
+static double angle(int r, double d) {
+    double bas = 0, haut = QUART, a = 0;
+    int n;
+
+    for (n = 0; n < 40; n++) {
+        a = (bas + haut) / 2;
+        if ((RAPPORT_MAX - r) * cos(a) - r * sin(a) - d * RAPPORT_MAX
+                * sin(4 * a) > 0) {
+            bas = a;
+        } else {
+            haut = a;
+        }
+    }
+    return a * 180 / M_PI;
+}
+
+/**
+ * Écrit une liste de valeurs en C, 8 par ligne.
+ */
+static void ecritListe(const int *valeurs, int nombre) {
+    int n;
+
+    printf("        {");
+    for (n = 0; n < nombre; n++) {
+        printf(n % 8 ? " %2d" : "\n            %2d", valeurs[n]);
+        if (n < nombre - 1) {
+            printf(",");
+        }
+    }
+    printf("\n        }");
+}
+
+int main(int argc, char **argv) {
+    int lineaire = 0, trame = 0;
+    double detente = 8;
+    int rapports[16], consigne[16];
+    int n, option;
+
+    while ((option = getopt(argc, argv, "cd:u")) != -1) {
+        switch (option) {
+            case 'c':
+                lineaire = 1;
+                break;
+            case 'd':
+                detente = atof(optarg);
+                break;
+            case 'u':
+                trame = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-d detente] [-u]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    // Les 8 micro-pas qui suivent sont symétriques: la bobine inversée
+    // par le changement de quadrant remonte comme l'autre est descendue.
+    for (n = 0; n <= MICRO_PAS; n++) {
+        rapports[n] = (int) lround(lineaire
+                ? rapportLineaire(n, detente / 100) : rapportSinus(n));
+        rapports[(2 * MICRO_PAS - n) % 16] = rapports[n];
+    }
+    for (n = 0; n < 16; n++) {
+        consigne[n] = rapports[n] > 16
+                ? rapports[n] : RAPPORT_MAX - rapports[n];
+        if (consigne[n] > 31) {
+            consigne[n] = 31;
+        }
+    }
+
+    if (trame) {
+        printf("55");
+        for (n = 0; n < 16; n++) {
+            printf(" %02X", rapports[n]);
+        }
+        for (n = 0; n < 4; n++) {
+            printf(" %02X", commutateurs[n]);
+        }
+        printf("\n");
+        return 0;
+    }
+
+    printf("        // Angle du rotor à chaque micro-pas, avec une détente"
+            " de %g%%:\n        //", detente);
+    for (n = 0; n <= MICRO_PAS; n++) {
+        printf(" %.1f", angle(rapports[n], detente / 100));
+    }
+    printf("\n");
+    ecritListe(rapports, 16);
+    printf(",\n");
+    ecritListe(commutateurs, 4);
+    printf(",\n#ifdef HACHAGE_MATERIEL\n");
+    ecritListe(consigne, 16);
+    printf("\n#endif\n");
+    return 0;
+}
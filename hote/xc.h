@@ -0,0 +1,203 @@
+/**
+ * Remplace <xc.h> pour compiler le contrôleur sur l'hôte.
+ * Chaque registre du PIC18F25K22 utilisé par le programme est une
+ * variable, dont chaque accès fait avancer le temps simulé et peut
+ * déclencher une interruption (voir simulateur.c).
+ */
+#ifndef XC_HOTE_H
+#define XC_HOTE_H
+
+#define interrupt
+#define low_priority
+
+/**
+ * Avance le temps simulé de quelques cycles, met à jour les
+ * périphériques et appelle les interruptions en attente.
+ * @param cycles Nombre de cycles d'instruction.
+ */
+void simAvance(unsigned char cycles);
+
+/**
+ * Signalent au simulateur une lecture de RCREG2, un accès à TXREG2 ou
+ * à TMR0L, qu'il traite au prochain accès à un registre.
+ */
+volatile unsigned char *simRCREG2(void);
+volatile unsigned char *simTXREG2(void);
+volatile unsigned char *simTMR0L(void);
+
+/** Cycles d'instruction comptés pour chaque accès à un registre.*/
+#define CYCLES_ACCES 4
+
+#define CLRWDT() simAvance(1)
+#define NOP() simAvance(1)
+#define SLEEP() simAvance(1)
+
+#define REG(nom) \
+    extern volatile unsigned char nom##_r;
+#define REGB(nom, champs) \
+    typedef union { unsigned char v; struct { champs } b; } nom##_t; \
+    extern volatile nom##_t nom##_r;
+#define B(n) unsigned n : 1;
+#define F(n, w) unsigned n : w;
+
+REG(CCPR3L) REG(PR2) REG(TMR2) REG(PR4) REG(TMR4) REG(TMR0L) REG(TMR0H)
+REG(ANSELA) REG(ANSELC) REG(TRISA) REG(LATA)
+REG(EEADR) REG(EEDATA) REG(EECON2)
+REG(SPBRG2) REG(SPBRGH2) REG(RCREG2) REG(TXREG2)
+REG(ADRESH) REG(ADRESL) REG(TMR1L) REG(TMR1H) REG(CCPR1L) REG(CCPR1H)
+
+REGB(PORTA, B(RA0) B(RA1) B(RA2) B(RA3) B(RA4) B(RA5) B(RA6) B(RA7))
+REGB(PORTB, B(RB0) B(RB1) B(RB2) B(RB3) B(RB4) B(RB5) B(RB6) B(RB7))
+REGB(PORTC, B(RC0) B(RC1) B(RC2) B(RC3) B(RC4) B(RC5) B(RC6) B(RC7))
+REGB(LATB, B(LATB0) B(LATB1) B(LATB2) B(LATB3) B(LATB4) B(LATB5) B(LATB6) B(LATB7))
+REGB(LATC, B(LATC0) B(LATC1) B(LATC2) B(LATC3) B(LATC4) B(LATC5) B(LATC6) B(LATC7))
+REGB(TRISB, B(RB0) B(RB1) B(RB2) B(RB3) B(RB4) B(RB5) B(RB6) B(RB7))
+REGB(TRISC, B(RC0) B(RC1) B(RC2) B(RC3) B(RC4) B(RC5) B(RC6) B(RC7))
+REGB(ANSELB, B(ANSB0) B(ANSB1) B(ANSB2) B(ANSB3) B(ANSB4) B(ANSB5) B(x6) B(x7))
+REGB(WPUB, B(WPUB0) B(WPUB1) B(WPUB2) B(WPUB3) B(WPUB4) B(WPUB5) B(WPUB6) B(WPUB7))
+REGB(IOCB, F(x0, 4) B(IOCB4) B(IOCB5) B(IOCB6) B(IOCB7))
+REGB(INTCON, B(RBIF) B(INT0IF) B(TMR0IF) B(RBIE) B(INT0IE) B(TMR0IE) B(GIEL) B(GIEH))
+REGB(INTCON2, B(RBIP) B(x1) B(TMR0IP) B(x3) B(INTEDG2) B(INTEDG1) B(INTEDG0) B(RBPU))
+REGB(INTCON3, B(INT1IF) B(INT2IF) B(x2) B(INT1IE) B(INT2IE) B(x5) B(INT1IP) B(INT2IP))
+REGB(PIR1, B(TMR1IF) B(TMR2IF) B(CCP1IF) B(SSP1IF) B(TX1IF) B(RC1IF) B(ADIF) B(x7))
+REGB(PIE1, B(TMR1IE) B(TMR2IE) B(CCP1IE) B(SSP1IE) B(TX1IE) B(RC1IE) B(ADIE) B(x7))
+REGB(IPR1, B(TMR1IP) B(TMR2IP) B(CCP1IP) B(SSP1IP) B(TX1IP) B(RC1IP) B(ADIP) B(x7))
+REGB(PIR2, B(CCP2IF) B(TMR3IF) B(HLVDIF) B(BCL1IF) B(EEIF) B(C2IF) B(C1IF) B(OSCFIF))
+REGB(PIR3, B(TMR3GIF) B(TMR5GIF) B(CTMUIF) B(TX2IF) B(RC2IF) B(BCL2IF) B(SSP2IF) B(x7))
+REGB(PIE3, B(TMR3GIE) B(TMR5GIE) B(CTMUIE) B(TX2IE) B(RC2IE) B(BCL2IE) B(SSP2IE) B(x7))
+REGB(IPR3, B(TMR3GIP) B(TMR5GIP) B(CTMUIP) B(TX2IP) B(RC2IP) B(BCL2IP) B(SSP2IP) B(x7))
+REGB(PIR5, B(TMR4IF) B(TMR5IF) B(TMR6IF) F(x3, 5))
+REGB(PIE5, B(TMR4IE) B(TMR5IE) B(TMR6IE) F(x3, 5))
+REGB(IPR5, B(TMR4IP) B(TMR5IP) B(TMR6IP) F(x3, 5))
+REGB(RCON, B(BOR) B(POR) B(PD) B(TO) B(RI) B(x5) B(SBOREN) B(IPEN))
+REGB(T0CON, F(T0PS, 3) B(PSA) B(T0SE) B(T0CS) B(T08BIT) B(TMR0ON))
+REGB(T1CON, B(TMR1ON) B(T1RD16) B(T1SYNC) B(T1SOSCEN) F(T1CKPS, 2) F(TMR1CS, 2))
+REGB(T2CON, F(T2CKPS, 2) B(TMR2ON) F(T2OUTPS, 4) B(x7))
+REGB(T4CON, F(T4CKPS, 2) B(TMR4ON) F(T4OUTPS, 4) B(x7))
+REGB(CCP1CON, F(CCP1M, 4) F(DC1B, 2) F(P1M, 2))
+REGB(CCP3CON, F(CCP3M, 4) F(DC3B, 2) F(P3M, 2))
+REGB(CCPTMRS0, F(C1TSEL, 2) B(x2) F(C2TSEL, 2) B(x5) F(C3TSEL, 2))
+REGB(CCP3AS, F(PSS3BD, 2) F(PSS3AC, 2) F(CCP3AS, 3) B(CCP3ASE))
+REGB(PWM3CON, F(P3DC, 7) B(P3RSEN))
+REGB(PSTR3CON, B(STR3A) B(STR3B) B(STR3C) B(STR3D) B(STR3SYNC) F(x5, 3))
+REGB(VREFCON0, F(x0, 4) F(FVRS, 2) B(FVRST) B(FVREN))
+REGB(VREFCON1, B(DACNSS) B(x1) F(DACPSS, 2) B(x4) B(DACOE) B(DACLPS) B(DACEN))
+REGB(VREFCON2, F(DACR, 5) F(x5, 3))
+REGB(CM1CON0, F(C1CH, 2) B(C1R) B(C1SP) B(C1POL) B(C1OE) B(C1OUT) B(C1ON))
+REGB(CM2CON0, F(C2CH, 2) B(C2R) B(C2SP) B(C2POL) B(C2OE) B(C2OUT) B(C2ON))
+REGB(CM2CON1, B(C2SYNC) B(C1SYNC) B(C2HYS) B(C1HYS) B(C2RSEL) B(C1RSEL) B(MC2OUT) B(MC1OUT))
+REGB(EECON1, B(RD) B(WR) B(WREN) B(WRERR) B(FREE) B(x5) B(CFGS) B(EEPGD))
+REGB(TXSTA2, B(TX9D) B(TRMT) B(BRGH) B(SENDB) B(SYNC) B(TXEN) B(TX9) B(CSRC))
+REGB(RCSTA2, B(RX9D) B(OERR) B(FERR) B(ADDEN) B(CREN) B(SREN) B(RX9) B(SPEN))
+REGB(BAUDCON2, B(ABDEN) B(WUE) B(x2) B(BRG16) B(CKTXP) B(DTRXP) B(RCIDL) B(ABDOVF))
+REGB(ADCON0, B(ADON) B(GO) F(CHS, 5) B(x7))
+REGB(ADCON1, F(NVCFG, 2) F(PVCFG, 2) F(x4, 3) B(TRIGSEL))
+REGB(ADCON2, F(ADCS, 3) F(ACQT, 3) B(x6) B(ADFM))
+REGB(OSCCON, F(SCS, 2) B(HFIOFS) B(OSTS) F(IRCF, 3) B(IDLEN))
+
+#undef REG
+#undef REGB
+#undef B
+#undef F
+
+/** Accès à un registre: le temps avance, puis l'accès a lieu.*/
+#define ACCES(r) (*(simAvance(CYCLES_ACCES), &(r)))
+
+#define CCPR3L ACCES(CCPR3L_r)
+#define PR2 ACCES(PR2_r)
+#define TMR2 ACCES(TMR2_r)
+#define PR4 ACCES(PR4_r)
+#define TMR4 ACCES(TMR4_r)
+#define TMR0L (*simTMR0L())
+#define TMR0H ACCES(TMR0H_r)
+#define ANSELA ACCES(ANSELA_r)
+#define ANSELC ACCES(ANSELC_r)
+#define TRISA ACCES(TRISA_r)
+#define LATA ACCES(LATA_r)
+#define EEADR ACCES(EEADR_r)
+#define EEDATA ACCES(EEDATA_r)
+#define EECON2 ACCES(EECON2_r)
+#define SPBRG2 ACCES(SPBRG2_r)
+#define SPBRGH2 ACCES(SPBRGH2_r)
+#define RCREG2 (*simRCREG2())
+#define TXREG2 (*simTXREG2())
+#define ADRESH ACCES(ADRESH_r)
+#define ADRESL ACCES(ADRESL_r)
+#define TMR1L ACCES(TMR1L_r)
+#define TMR1H ACCES(TMR1H_r)
+#define CCPR1L ACCES(CCPR1L_r)
+#define CCPR1H ACCES(CCPR1H_r)
+
+#define PORTA ACCES(PORTA_r.v)
+#define PORTAbits ACCES(PORTA_r.b)
+#define PORTB ACCES(PORTB_r.v)
+#define PORTBbits ACCES(PORTB_r.b)
+#define PORTC ACCES(PORTC_r.v)
+#define PORTCbits ACCES(PORTC_r.b)
+#define LATB ACCES(LATB_r.v)
+#define LATBbits ACCES(LATB_r.b)
+#define LATC ACCES(LATC_r.v)
+#define LATCbits ACCES(LATC_r.b)
+#define TRISB ACCES(TRISB_r.v)
+#define TRISBbits ACCES(TRISB_r.b)
+#define TRISC ACCES(TRISC_r.v)
+#define TRISCbits ACCES(TRISC_r.b)
+#define ANSELB ACCES(ANSELB_r.v)
+#define ANSELBbits ACCES(ANSELB_r.b)
+#define WPUB ACCES(WPUB_r.v)
+#define WPUBbits ACCES(WPUB_r.b)
+#define IOCB ACCES(IOCB_r.v)
+#define IOCBbits ACCES(IOCB_r.b)
+#define INTCON ACCES(INTCON_r.v)
+#define INTCONbits ACCES(INTCON_r.b)
+#define INTCON2 ACCES(INTCON2_r.v)
+#define INTCON2bits ACCES(INTCON2_r.b)
+#define INTCON3 ACCES(INTCON3_r.v)
+#define INTCON3bits ACCES(INTCON3_r.b)
+#define PIR1 ACCES(PIR1_r.v)
+#define PIR1bits ACCES(PIR1_r.b)
+#define PIE1bits ACCES(PIE1_r.b)
+#define IPR1bits ACCES(IPR1_r.b)
+#define PIR2bits ACCES(PIR2_r.b)
+#define PIR3bits ACCES(PIR3_r.b)
+#define PIE3bits ACCES(PIE3_r.b)
+#define IPR3bits ACCES(IPR3_r.b)
+#define PIR5bits ACCES(PIR5_r.b)
+#define PIE5bits ACCES(PIE5_r.b)
+#define IPR5bits ACCES(IPR5_r.b)
+#define RCONbits ACCES(RCON_r.b)
+#define T0CON ACCES(T0CON_r.v)
+#define T0CONbits ACCES(T0CON_r.b)
+#define T1CON ACCES(T1CON_r.v)
+#define T1CONbits ACCES(T1CON_r.b)
+#define T2CON ACCES(T2CON_r.v)
+#define T2CONbits ACCES(T2CON_r.b)
+#define T4CON ACCES(T4CON_r.v)
+#define T4CONbits ACCES(T4CON_r.b)
+#define CCP1CONbits ACCES(CCP1CON_r.b)
+#define CCP3CON ACCES(CCP3CON_r.v)
+#define CCP3CONbits ACCES(CCP3CON_r.b)
+#define CCPTMRS0bits ACCES(CCPTMRS0_r.b)
+#define CCP3ASbits ACCES(CCP3AS_r.b)
+#define PWM3CON ACCES(PWM3CON_r.v)
+#define PWM3CONbits ACCES(PWM3CON_r.b)
+#define PSTR3CON ACCES(PSTR3CON_r.v)
+#define PSTR3CONbits ACCES(PSTR3CON_r.b)
+#define VREFCON0bits ACCES(VREFCON0_r.b)
+#define VREFCON1bits ACCES(VREFCON1_r.b)
+#define VREFCON2 ACCES(VREFCON2_r.v)
+#define VREFCON2bits ACCES(VREFCON2_r.b)
+#define CM1CON0bits ACCES(CM1CON0_r.b)
+#define CM2CON0bits ACCES(CM2CON0_r.b)
+#define CM2CON1bits ACCES(CM2CON1_r.b)
+#define EECON1 ACCES(EECON1_r.v)
+#define EECON1bits ACCES(EECON1_r.b)
+#define TXSTA2bits ACCES(TXSTA2_r.b)
+#define RCSTA2bits ACCES(RCSTA2_r.b)
+#define BAUDCON2bits ACCES(BAUDCON2_r.b)
+#define ADCON0bits ACCES(ADCON0_r.b)
+#define ADCON1bits ACCES(ADCON1_r.b)
+#define ADCON2bits ACCES(ADCON2_r.b)
+#define OSCCONbits ACCES(OSCCON_r.b)
+
+#endif